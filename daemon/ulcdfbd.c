@@ -0,0 +1,91 @@
+// ulcdfbd - shares one panel between processes.
+//
+// Owns the panel and exports its framebuffer to clients of the ulcd_fb API,
+// see ulcd_fb.h. Usage: ulcdfbd [-s socket] [-c costfile] [-v] device
+//
+// With -c, damage is merged into blits according to the panel's saved cost
+// model, see ulcd_cost.h.
+
+#include "ulcd_cost.h"
+#include "ulcd_driver.h"
+#include "ulcd_fb.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+int main(int argc, char **argv) {
+    const char *path = ULCD_FB_SOCKET;
+    const char *cost_file = 0;
+    int verbose = 0, opt;
+    while((opt = getopt(argc, argv, "s:c:v")) != -1) {
+        switch(opt) {
+            case 's': path = optarg; break;
+            case 'c': cost_file = optarg; break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s socket] [-c costfile] [-v] device\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc) {
+        fprintf(stderr, "Usage: %s [-s socket] [-c costfile] [-v] device\n", argv[0]);
+        return 1;
+    }
+
+    ulcd_dev *dev = ulcd_init(argv[optind]);
+    if(!dev) {
+        fprintf(stderr, "%s\n", ulcd_get_error_str());
+        return 1;
+    }
+    ulcd_fb_server *server = ulcd_fb_server_create(dev, path);
+    if(!server) {
+        fprintf(stderr, "%s\n", ulcd_get_error_str());
+        ulcd_close(dev);
+        return 1;
+    }
+    if(cost_file) {
+        ulcd_cost_model model;
+        if(ulcd_cost_load(dev, cost_file, &model)) {
+            ulcd_fb_server_set_cost_model(server, &model);
+        } else {
+            fprintf(stderr, "%s, using default merging\n", ulcd_get_error_str());
+        }
+    }
+    if(verbose) {
+        printf("%s %dx%d on %s\n", dev->name, dev->w, dev->h, path);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    int ok = 1;
+    while(running && ok) {
+        ok = ulcd_fb_server_run(server, 1000);
+    }
+    if(!ok) {
+        fprintf(stderr, "%s\n", ulcd_get_error_str());
+    }
+
+    if(verbose) {
+        ulcd_fb_stats st;
+        ulcd_fb_server_get_stats(server, &st);
+        printf("%ld damage messages, %ld pushes, %ld blits, %ld pixels, %ld errors\n",
+               st.damage_msgs, st.pushes, st.blits, st.pixels, st.errors);
+    }
+    ulcd_fb_server_free(server);
+    ulcd_close(dev);
+    return ok ? 0 : 1;
+}
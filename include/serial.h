@@ -37,10 +37,21 @@ typedef struct serial_port {
 #endif
 } serial_port;
 
+typedef struct serial_chunk {
+    const char *data;
+    int len;
+} serial_chunk;
+
 char* serial_get_error_str();
 serial_port* serial_open(const char* port, int speed);
 void serial_close(serial_port *port);
 int serial_read(serial_port *port, char* buffer, int len);
 int serial_write(serial_port *port, const char* buffer, int len);
+int serial_writev(serial_port *port, const serial_chunk *chunks, int count);
+int serial_wait(serial_port *port, int timeout_ms);
+int serial_set_low_latency(serial_port *port, int enable);
+int serial_set_latency_timer(const char* device, int ms);
+int serial_get_baud(serial_port *port);
+int serial_get_adapter(serial_port *port, char *buf, int len);
 
 #endif // __SERIAL_H
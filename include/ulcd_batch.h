@@ -0,0 +1,46 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Optimising draw batches. Drawing calls are recorded and only sent on flush.
+// Before sending, commands that fall off the screen are dropped, solid
+// rectangles are clipped to it, commands hidden by a later solid rectangle
+// or clear are dropped, touching solid rectangles of one colour are merged,
+// and pen style changes the panel does not need are skipped.
+
+typedef struct ulcd_batch ulcd_batch;
+
+typedef struct {
+    long submitted;
+    long sent;
+    long culled;
+    long overdrawn;
+    long merged;
+    long pen_changes;
+    long pen_skipped;
+} ulcd_batch_stats;
+
+ulcd_batch* ulcd_batch_create(ulcd_dev *dev);
+void ulcd_batch_free(ulcd_batch *batch);
+int ulcd_batch_flush(ulcd_batch *batch);
+void ulcd_batch_get_stats(ulcd_batch *batch, ulcd_batch_stats *stats);
+
+void ulcd_batch_pen_style(ulcd_batch *batch, int style);
+void ulcd_batch_clear(ulcd_batch *batch);
+void ulcd_batch_pixel(ulcd_batch *batch, int x, int y, uint16_t color);
+void ulcd_batch_line(ulcd_batch *batch, int x0, int y0, int x1, int y1, uint16_t color);
+void ulcd_batch_rect(ulcd_batch *batch, int x0, int y0, int x1, int y1, uint16_t color);
+void ulcd_batch_circle(ulcd_batch *batch, int x, int y, int radius, uint16_t color);
+void ulcd_batch_ellipse(ulcd_batch *batch, int x, int y, int xrad, int yrad, uint16_t color);
+void ulcd_batch_text(ulcd_batch *batch, const char *text, int x, int y, int font, uint16_t color);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
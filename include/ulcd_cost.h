@@ -0,0 +1,62 @@
+#ifndef COST_H
+#define COST_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-command cost model for the connected panel. Calibration times each
+// drawing command at several sizes and fits
+//
+//   time = rtt + bytes * byte_ms + base_ms + units * unit_ms
+//
+// where rtt and byte_ms describe the link and base_ms / unit_ms how long the
+// panel takes to execute the command. Models are saved to a file keyed by
+// the panel's type, versions and resolution, the baud rate and the serial
+// adapter. rtt is measured again whenever a model is loaded.
+
+enum COST_OPS {
+    ULCD_OP_CLEAR = 0,   // units: none
+    ULCD_OP_PIXEL,       // units: none
+    ULCD_OP_LINE,        // units: length in pixels
+    ULCD_OP_RECT,        // units: area of a solid rectangle
+    ULCD_OP_CIRCLE,      // units: radius squared, solid
+    ULCD_OP_ELLIPSE,     // units: xrad * yrad, solid
+    ULCD_OP_TEXT,        // units: characters
+    ULCD_OP_BLIT,        // units: pixels
+    ULCD_OP_COUNT,
+};
+
+typedef struct {
+    double base_ms;
+    double unit_ms;
+} ulcd_op_cost;
+
+typedef struct {
+    int type, hw_ver, sw_ver, w, h;  // Device identity
+    int baud;                        // Link identity
+    char link[48];                   // Serial adapter, see serial_get_adapter
+    double rtt_ms;                   // Round trip of a one byte command
+    double byte_ms;                  // Time on the wire per byte
+    ulcd_op_cost ops[ULCD_OP_COUNT];
+} ulcd_cost_model;
+
+int ulcd_cost_calibrate(ulcd_dev *dev, int reps, ulcd_cost_model *model);
+int ulcd_cost_load(ulcd_dev *dev, const char *file, ulcd_cost_model *model);
+int ulcd_cost_save(const ulcd_cost_model *model, const char *file);
+int ulcd_cost_init(ulcd_dev *dev, const char *file, ulcd_cost_model *model);
+
+int ulcd_cost_bytes(int op, double units);
+double ulcd_cost_estimate(const ulcd_cost_model *model, int op, double units);
+double ulcd_cost_rect(const ulcd_cost_model *model, int w, int h);
+double ulcd_cost_blit(const ulcd_cost_model *model, int w, int h);
+int ulcd_cost_blit_rows(const ulcd_cost_model *model, int w, double budget_ms);
+int ulcd_cost_merge_bytes(const ulcd_cost_model *model);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
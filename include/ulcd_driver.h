@@ -17,6 +17,9 @@ typedef struct ulcd_dev {
     int type;
     int w,h;
     int hw_ver, sw_ver;
+    int timeout;
+    int retries;
+    int pen;
 } ulcd_dev;
 
 // Drawing stuff
@@ -26,6 +29,10 @@ enum PEN_STYLES {
     ULCD_PEN_WIREFRAME = 0x01,
 };
 
+enum BLIT_FLAGS {
+    ULCD_BLIT_SWAP = 0x01,
+};
+
 // Audio
 
 enum {
@@ -53,6 +60,32 @@ typedef struct {
     int16_t type;
 } ulcd_event;
 
+// Colour replacement rules. ulcd_replace_colors() applies a set of rules as
+// one mapping. The panel can only replace one colour at a time, so swaps like
+// A->B, B->A need a scratch colour from the caller, one not on screen in the
+// region.
+
+typedef struct {
+    uint16_t from;
+    uint16_t to;
+} ulcd_color_map;
+
+// Merging damaged rows into blit rectangles. Rows are added top to bottom
+// with their span of changed columns. A run of clean rows between two
+// changed regions is sent along with them when that costs fewer than
+// merge_bytes of pixel data, as a separate blit costs a header and a round
+// trip.
+
+typedef struct {
+    int x0, y0, x1, y1;  // Inclusive corners
+} ulcd_rect;
+
+typedef struct {
+    int merge_bytes;
+    int active;
+    ulcd_rect cur;
+} ulcd_row_merge;
+
 // Init and deinit functions
 
 ulcd_dev* ulcd_init(const char* device);
@@ -61,6 +94,9 @@ void ulcd_close(ulcd_dev *dev);
 // Utility stuff
 
 char* ulcd_get_error_str();
+void ulcd_set_timeout(ulcd_dev *dev, int timeout_ms, int retries);
+int ulcd_resync(ulcd_dev *dev);
+int ulcd_send_command(ulcd_dev *dev, const char *cmd, int len);
 
 // Panel management
 
@@ -91,17 +127,26 @@ int ulcd_sd_image_load(ulcd_dev *dev, const char *file, uint16_t x, uint16_t y);
 
 // Drawing
 
+void ulcd_encode_blit(char *buf, uint16_t x, uint16_t y, uint16_t w, uint16_t h);
 int ulcd_blit(ulcd_dev *dev, uint16_t x, uint16_t y, uint16_t w, uint16_t h, const char* data);
+int ulcd_blit_rect(ulcd_dev *dev, uint16_t x, uint16_t y, const char *base, int stride, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h, int flags);
 int ulcd_draw_pixel(ulcd_dev *dev, uint16_t x, uint16_t y, uint16_t color);
 int ulcd_draw_ellipse(ulcd_dev *dev, uint16_t x, uint16_t y, uint16_t xrad, uint16_t yrad, uint16_t color);
 int ulcd_draw_line(ulcd_dev *dev, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t color);
 int ulcd_draw_rect(ulcd_dev *dev, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t color);
 int ulcd_draw_circle(ulcd_dev *dev, uint16_t x, uint16_t y, uint16_t radius, uint16_t color);
 int ulcd_draw_text(ulcd_dev *dev, const char* text, int x, int y, int font, uint16_t color);
+int ulcd_text_metrics(int font, int *advance, int *height);
+void ulcd_row_merge_init(ulcd_row_merge *m, int merge_bytes);
+int ulcd_row_merge_add(ulcd_row_merge *m, int y, int lo, int hi, ulcd_rect *out);
+int ulcd_row_merge_finish(ulcd_row_merge *m, ulcd_rect *out);
 int ulcd_pen_style(ulcd_dev *dev, int style);
+int ulcd_replace_color(ulcd_dev *dev, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t from, uint16_t to);
+int ulcd_replace_colors(ulcd_dev *dev, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, const ulcd_color_map *maps, int count, int scratch);
 uint16_t alloc_color(float r, float g, float b);
 
 uint16_t ulcd_read_pixel(ulcd_dev *dev, uint16_t x, uint16_t y);
+int ulcd_get_pixel(ulcd_dev *dev, uint16_t x, uint16_t y, uint16_t *color);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,235 @@
+/*
+ * Header-only C++ interface for libulcd32pt. Requires C++20.
+ *
+ * license: MIT License. Please read LICENSE for more information.
+*/
+
+#ifndef DRIVER_HPP
+#define DRIVER_HPP
+
+#include "ulcd_driver.h"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <utility>
+
+namespace ulcd {
+
+// Colours
+
+/**
+  * RGB565 colour from 0..255 components. Usable in constant expressions.
+  */
+constexpr uint16_t rgb565(uint8_t r, uint8_t g, uint8_t b) {
+    return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+/**
+  * RGB565 colour from 0.0..1.0 components. Same encoding as alloc_color().
+  */
+constexpr uint16_t rgb565f(float r, float g, float b) {
+    auto clamp = [](float v) { return v > 1.0f ? 1.0f : v; };
+    return (uint16_t)(((uint8_t)(31 * clamp(r)) << 11)
+                    | ((uint8_t)(63 * clamp(g)) << 5)
+                    | ((uint8_t)(31 * clamp(b))));
+}
+
+// Command encoding
+
+namespace detail {
+    template <std::size_t N>
+    constexpr void put_word(std::array<char, N> &buf, std::size_t pos, uint16_t word) {
+        buf[pos] = (char)(word >> 8);
+        buf[pos + 1] = (char)(word & 0xFF);
+    }
+
+    template <typename... Words>
+    constexpr auto encode(uint8_t op, Words... words) {
+        std::array<char, 1 + 2 * sizeof...(Words)> buf{};
+        buf[0] = (char)op;
+        std::size_t pos = 1;
+        ((put_word(buf, pos, (uint16_t)words), pos += 2), ...);
+        return buf;
+    }
+}
+
+constexpr auto encode_clear() { return detail::encode(0x45); }
+
+constexpr auto encode_pixel(uint16_t x, uint16_t y, uint16_t color) {
+    return detail::encode(0x50, x, y, color);
+}
+
+constexpr auto encode_line(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t color) {
+    return detail::encode(0x4C, x0, y0, x1, y1, color);
+}
+
+constexpr auto encode_rect(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t color) {
+    return detail::encode(0x72, x0, y0, x1, y1, color);
+}
+
+constexpr auto encode_circle(uint16_t x, uint16_t y, uint16_t radius, uint16_t color) {
+    return detail::encode(0x43, x, y, radius, color);
+}
+
+constexpr auto encode_ellipse(uint16_t x, uint16_t y, uint16_t xrad, uint16_t yrad, uint16_t color) {
+    return detail::encode(0x65, x, y, xrad, yrad, color);
+}
+
+constexpr auto encode_replace_color(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1,
+                                    uint16_t from, uint16_t to) {
+    return detail::encode(0x6B, x0, y0, x1, y1, from, to);
+}
+
+/**
+  * A command whose bytes are fixed at compile time, eg.
+  * Command<encode_rect(0, 0, 10, 10, rgb565(255, 0, 0))>.
+  */
+template <auto Bytes>
+struct Command {
+    static constexpr auto bytes = Bytes;
+};
+
+// Pixel views
+
+/**
+  * A read-only view of native-endian RGB565 pixels. Rows are stride pixels apart.
+  */
+struct PixelView {
+    std::span<const uint16_t> pixels;
+    uint16_t w, h;
+    std::size_t stride;
+
+    constexpr PixelView(std::span<const uint16_t> px, uint16_t w, uint16_t h)
+        : pixels(px), w(w), h(h), stride(w) {}
+    constexpr PixelView(std::span<const uint16_t> px, uint16_t w, uint16_t h, std::size_t stride)
+        : pixels(px), w(w), h(h), stride(stride) {}
+
+    /**
+      * View of a rectangle inside this one. A rectangle that does not fit
+      * gives an empty view, which is not valid() unless sh is 0.
+      */
+    constexpr PixelView sub(uint16_t x, uint16_t y, uint16_t sw, uint16_t sh) const {
+        std::size_t offset = (std::size_t)y * stride + x;
+        if(x + sw > w || y + sh > h || offset > pixels.size()) {
+            return PixelView(std::span<const uint16_t>(), sw, sh, stride);
+        }
+        return PixelView(pixels.subspan(offset), sw, sh, stride);
+    }
+
+    constexpr bool valid() const {
+        return h == 0 || pixels.size() >= (std::size_t)(h - 1) * stride + w;
+    }
+};
+
+// Device
+
+/**
+  * Owns an ulcd_dev. Move-only; the device is closed on destruction.
+  * Operations return false on failure, see error().
+  */
+class Device {
+public:
+    Device() = default;
+    explicit Device(const char *port) : dev_(ulcd_init(port)) {}
+    explicit Device(ulcd_dev *dev) : dev_(dev) {}
+    ~Device() { ulcd_close(dev_); }
+
+    Device(const Device&) = delete;
+    Device& operator=(const Device&) = delete;
+    Device(Device &&o) noexcept : dev_(std::exchange(o.dev_, nullptr)) {}
+    Device& operator=(Device &&o) noexcept {
+        if(this != &o) {
+            ulcd_close(dev_);
+            dev_ = std::exchange(o.dev_, nullptr);
+        }
+        return *this;
+    }
+
+    explicit operator bool() const { return dev_ != nullptr; }
+    ulcd_dev* get() const { return dev_; }
+    ulcd_dev* release() { return std::exchange(dev_, nullptr); }
+    static const char* error() { return ulcd_get_error_str(); }
+
+    int width() const { return dev_->w; }
+    int height() const { return dev_->h; }
+
+    // Pre-encoded commands
+
+    template <std::size_t N>
+    bool send(const std::array<char, N> &cmd) {
+        return ulcd_send_command(dev_, cmd.data(), (int)N);
+    }
+
+    template <typename Cmd>
+    bool send() {
+        return send(Cmd::bytes);
+    }
+
+    // Drawing
+
+    bool clear() { return ulcd_clear(dev_); }
+    bool pen_style(int style) { return ulcd_pen_style(dev_, style); }
+
+    bool pixel(uint16_t x, uint16_t y, uint16_t color) {
+        return send(encode_pixel(x, y, color));
+    }
+    bool line(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t color) {
+        return send(encode_line(x0, y0, x1, y1, color));
+    }
+    bool rect(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t color) {
+        return send(encode_rect(x0, y0, x1, y1, color));
+    }
+    bool circle(uint16_t x, uint16_t y, uint16_t radius, uint16_t color) {
+        return send(encode_circle(x, y, radius, color));
+    }
+    bool ellipse(uint16_t x, uint16_t y, uint16_t xrad, uint16_t yrad, uint16_t color) {
+        return send(encode_ellipse(x, y, xrad, yrad, color));
+    }
+    bool text(const char *str, int x, int y, int font, uint16_t color) {
+        return ulcd_draw_text(dev_, str, x, y, font, color);
+    }
+    bool replace_color(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1,
+                       uint16_t from, uint16_t to) {
+        return send(encode_replace_color(x0, y0, x1, y1, from, to));
+    }
+
+    /**
+      * Blits wire-format (big-endian RGB565) pixels. Size must be exactly w*h*2.
+      */
+    bool blit(uint16_t x, uint16_t y, uint16_t w, uint16_t h, std::span<const std::byte> data) {
+        if(data.size() != (std::size_t)w * h * 2) {
+            return fail("Blit data size does not match.");
+        }
+        return ulcd_blit(dev_, x, y, w, h, reinterpret_cast<const char*>(data.data()));
+    }
+
+    /**
+      * Blits native-endian pixels from a possibly strided view. Rows are sent
+      * straight from the view, without copying them first.
+      */
+    bool blit(uint16_t x, uint16_t y, const PixelView &view) {
+        if(!view.valid()) {
+            return fail("Pixel view out of range.");
+        }
+        constexpr int flags = (std::endian::native == std::endian::little) ? ULCD_BLIT_SWAP : 0;
+        return ulcd_blit_rect(dev_, x, y,
+                              reinterpret_cast<const char*>(view.pixels.data()),
+                              (int)(view.stride * 2), 0, 0, view.w, view.h, flags);
+    }
+
+private:
+    static bool fail(const char *msg) {
+        std::strcpy(ulcd_get_error_str(), msg);
+        return false;
+    }
+
+    ulcd_dev *dev_ = nullptr;
+};
+
+} // namespace ulcd
+
+#endif // DRIVER_HPP
@@ -0,0 +1,42 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Non-blocking command engine. Drives any number of panels from one thread
+// using epoll. Linux only.
+
+typedef struct ulcd_engine ulcd_engine;
+
+// Called when a command completes. ok is 0 if the panel NAKed, the reply did
+// not arrive within dev->timeout, or the command was dropped because its
+// device was removed or its port failed. reply holds reply_len bytes received
+// from the panel. Callbacks may submit commands and remove devices.
+// After a timeout or a garbled ACK every command in flight on that device
+// fails, and the link is resynced before queued commands are written, so a
+// late reply is never taken for the next command's. A device that can't be
+// resynced is removed.
+typedef void (*ulcd_engine_cb)(ulcd_dev *dev, int ok, const char *reply, int reply_len, void *userdata);
+
+ulcd_engine* ulcd_engine_create();
+void ulcd_engine_free(ulcd_engine *eng);
+
+int ulcd_engine_add(ulcd_engine *eng, ulcd_dev *dev);
+int ulcd_engine_remove(ulcd_engine *eng, ulcd_dev *dev);
+int ulcd_engine_set_pipeline(ulcd_engine *eng, int depth);
+
+int ulcd_engine_submit(ulcd_engine *eng, ulcd_dev *dev,
+                       const char *cmd, int len, int reply_len,
+                       ulcd_engine_cb cb, void *userdata);
+int ulcd_engine_pending(ulcd_engine *eng, ulcd_dev *dev);
+int ulcd_engine_run(ulcd_engine *eng, int timeout_ms);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef FB_H
+#define FB_H
+
+#include "ulcd_driver.h"
+#include "ulcd_cost.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shared framebuffer. A server process owns the panel and exports a
+// native-endian RGB565 framebuffer in shared memory over a Unix socket.
+// Clients draw straight into the mapping and report damaged rectangles; the
+// server coalesces damage from all clients and blits it to the panel. Touch
+// events are sent to every client. Linux only.
+
+#define ULCD_FB_SOCKET "/tmp/ulcd-fb.sock"
+#define ULCD_FB_MAX_CLIENTS 16
+#define ULCD_FB_QUEUE 16
+
+enum FB_MESSAGES {
+    ULCD_FB_HELLO = 1,  // Server to client, with the framebuffer fd. w, h, value = stride in bytes
+    ULCD_FB_DAMAGE,     // Client to server. x, y, w, h
+    ULCD_FB_SYNC,       // Client to server, answered once earlier damage is on the panel. value = sequence
+    ULCD_FB_TOUCH,      // Server to client. x, y, value = EVENT_TYPES
+};
+
+typedef struct {
+    int32_t type;
+    int32_t x, y, w, h;
+    int32_t value;
+} ulcd_fb_msg;
+
+// Server
+
+typedef struct ulcd_fb_server ulcd_fb_server;
+
+typedef struct {
+    long damage_msgs;
+    long pushes;
+    long blits;
+    long pixels;
+    long errors;
+} ulcd_fb_stats;
+
+ulcd_fb_server* ulcd_fb_server_create(ulcd_dev *dev, const char *path);
+void ulcd_fb_server_free(ulcd_fb_server *server);
+int ulcd_fb_server_run(ulcd_fb_server *server, int timeout_ms);
+void ulcd_fb_server_get_stats(ulcd_fb_server *server, ulcd_fb_stats *stats);
+void ulcd_fb_server_set_cost_model(ulcd_fb_server *server, const ulcd_cost_model *model);
+
+// Client
+
+typedef struct {
+    int fd;              // Socket, can be polled for touch events
+    int w, h;
+    int stride;          // Bytes between rows
+    uint16_t *pixels;    // Shared framebuffer
+    size_t size;
+    int seq;
+    ulcd_event queue[ULCD_FB_QUEUE];
+    int head, count;
+} ulcd_fb_client;
+
+ulcd_fb_client* ulcd_fb_connect(const char *path);
+void ulcd_fb_disconnect(ulcd_fb_client *client);
+int ulcd_fb_damage(ulcd_fb_client *client, int x, int y, int w, int h);
+int ulcd_fb_sync(ulcd_fb_client *client, int timeout_ms);
+int ulcd_fb_get_event(ulcd_fb_client *client, ulcd_event *event);
+int ulcd_fb_wait_event(ulcd_fb_client *client, ulcd_event *event, int timeout_ms);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Host-rendered bitmap fonts. Fonts are loaded from BDF files and rasterised
+// on the host. An atlas renders a font in one colour pair; its glyphs can be
+// uploaded to the panel's SD card once, after which text is drawn by loading
+// the stored glyph images instead of sending their pixels again.
+
+typedef struct {
+    int w, h;          // Bitmap size
+    int xoff, yoff;    // Bitmap offset from the origin, y up from the baseline
+    int advance;
+    unsigned char *bits; // (w+7)/8 bytes per row, MSB first. 0 if missing.
+} ulcd_glyph;
+
+typedef struct {
+    int ascent, descent;
+    ulcd_glyph glyphs[256];
+    signed char *kerning; // 256*256 adjustments, allocated when first set
+} ulcd_font;
+
+typedef struct {
+    ulcd_dev *dev;
+    ulcd_font *font;
+    int id;
+    uint16_t fg, bg;
+    int height;
+    char *cells[256];   // Rasterised glyph cells in wire format, built lazily
+    int uploaded[256];
+} ulcd_font_atlas;
+
+ulcd_font* ulcd_font_load_bdf(const char *file);
+void ulcd_font_free(ulcd_font *font);
+void ulcd_font_set_kerning(ulcd_font *font, unsigned char left, unsigned char right, int adjust);
+int ulcd_font_text_width(ulcd_font *font, const char *text);
+
+ulcd_font_atlas* ulcd_font_atlas_create(ulcd_dev *dev, ulcd_font *font, int id, uint16_t fg, uint16_t bg);
+void ulcd_font_atlas_free(ulcd_font_atlas *atlas);
+int ulcd_font_atlas_upload(ulcd_font_atlas *atlas, const char *chars, uint16_t scratch_x, uint16_t scratch_y);
+void ulcd_font_atlas_attach(ulcd_font_atlas *atlas, const char *chars);
+int ulcd_font_draw(ulcd_font_atlas *atlas, const char *text, int x, int y);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
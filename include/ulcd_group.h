@@ -0,0 +1,40 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Device groups. A command is encoded once and written to every member
+// concurrently, and each member's ACK is collected separately. A member
+// that times out is resynced before it is used again; if it was left in the
+// middle of a blit, the rest of the blit is sent as black first. Members
+// that can't be resynced report ULCD_GROUP_TIMEOUT until they recover.
+// Linux only.
+
+typedef struct ulcd_group ulcd_group;
+
+enum GROUP_STATUS {
+    ULCD_GROUP_OK = 0,
+    ULCD_GROUP_NAK,
+    ULCD_GROUP_TIMEOUT,
+    ULCD_GROUP_IO_ERROR,
+};
+
+ulcd_group* ulcd_group_create(ulcd_dev **devs, int count);
+void ulcd_group_free(ulcd_group *group);
+void ulcd_group_set_timeout(ulcd_group *group, int timeout_ms);
+int ulcd_group_size(ulcd_group *group);
+int ulcd_group_status(ulcd_group *group, int index);
+
+int ulcd_group_send(ulcd_group *group, const char *cmd, int len);
+int ulcd_group_clear(ulcd_group *group);
+int ulcd_group_blit(ulcd_group *group, uint16_t x, uint16_t y, uint16_t w, uint16_t h, const char* data);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
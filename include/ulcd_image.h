@@ -0,0 +1,38 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Host side image conversion. Decodes BMP (24/32 bit uncompressed, 16/32
+// bit with colour masks) and binary PPM files, scales them and converts them to wire-ready RGB565.
+// Converted images are kept in an in-memory LRU cache, and optionally in an
+// on-disk cache keyed by source hash and target size. Not thread safe.
+
+enum IMAGE_FLAGS {
+    ULCD_IMAGE_DITHER = 0x01,
+    ULCD_IMAGE_NO_CACHE = 0x02,
+};
+
+typedef struct {
+    uint16_t w, h;
+    char *data; // Big-endian RGB565, w*h*2 bytes, ready for ulcd_blit()
+    int refs;
+} ulcd_image;
+
+ulcd_image* ulcd_image_load(const char *file, int w, int h, int flags);
+ulcd_image* ulcd_image_convert(const char *src, int src_len, int w, int h, int flags);
+void ulcd_image_free(ulcd_image *img);
+int ulcd_image_show(ulcd_dev *dev, const char *file, uint16_t x, uint16_t y, int w, int h, int flags);
+
+void ulcd_image_cache_setup(int max_entries, const char *cache_dir);
+void ulcd_image_cache_clear();
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opt-in low latency tuning for the serial link, and round trip measurement
+// to check the result. Linux only.
+
+enum LATENCY_FLAGS {
+    ULCD_LATENCY_ASYNC = 0x01,       // Set ASYNC_LOW_LATENCY on the tty
+    ULCD_LATENCY_FTDI_TIMER = 0x02,  // Set the USB-serial latency timer to 1ms
+};
+
+typedef struct {
+    int samples;
+    double min_ms, avg_ms, max_ms;
+} ulcd_rtt_stats;
+
+typedef void (*ulcd_rt_func)(void *userdata);
+
+int ulcd_set_low_latency(ulcd_dev *dev, const char *device, int flags);
+int ulcd_measure_rtt(ulcd_dev *dev, int samples, ulcd_rtt_stats *stats);
+int ulcd_rt_promote(int cpu, int priority);
+int ulcd_rt_run(int cpu, int priority, ulcd_rt_func func, void *userdata);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
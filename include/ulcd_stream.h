@@ -0,0 +1,52 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "ulcd_driver.h"
+#include "ulcd_cost.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frame streaming. A producer thread pulls frames from a source, diffs them
+// against what the panel shows and encodes the changed regions, while a
+// sender thread transmits the previous frame. Linux only.
+
+typedef struct ulcd_stream ulcd_stream;
+
+// Fills pixels (w*h native-endian RGB565 values, eg. from alloc_color()) with
+// the next frame. Returns 1 for a frame, 0 at the end of the stream.
+typedef int (*ulcd_frame_source)(void *userdata, uint16_t *pixels, int w, int h);
+
+// What to do when a frame is ready but the previous one has not been sent yet.
+enum STREAM_POLICY {
+    ULCD_STREAM_BLOCK = 0,     // Wait for the link. No frames are dropped.
+    ULCD_STREAM_DROP_OLDEST,   // Replace the waiting frame with the new one.
+    ULCD_STREAM_DROP_NEWEST,   // Throw away the new frame.
+};
+
+typedef struct {
+    long frames_produced;
+    long frames_sent;
+    long frames_dropped;
+    long blits;
+    long bytes_sent;
+    long errors;
+    double fps;              // Frames sent per second
+    double link_utilisation; // Fraction of time spent transmitting, 0..1
+} ulcd_stream_stats;
+
+ulcd_stream* ulcd_stream_start(ulcd_dev *dev,
+                               uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                               ulcd_frame_source source, void *userdata,
+                               int policy);
+int ulcd_stream_wait(ulcd_stream *stream);
+void ulcd_stream_stop(ulcd_stream *stream);
+void ulcd_stream_set_cost_model(ulcd_stream *stream, const ulcd_cost_model *model);
+void ulcd_stream_get_stats(ulcd_stream *stream, ulcd_stream_stats *stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
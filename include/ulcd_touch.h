@@ -0,0 +1,37 @@
+#ifndef TOUCH_H
+#define TOUCH_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Adaptive touch polling. The poll interval backs off exponentially while
+// the panel is idle, and drops to the minimum while the screen is touched.
+// Move events that have not been read yet are merged into one.
+
+#define ULCD_TOUCH_QUEUE 16
+
+typedef struct {
+    ulcd_dev *dev;
+    int min_interval;
+    int max_interval;
+    int interval;
+    long next_poll;
+    int touching;
+    ulcd_event queue[ULCD_TOUCH_QUEUE];
+    int head, count;
+} ulcd_touch_poller;
+
+void ulcd_touch_init(ulcd_touch_poller *p, ulcd_dev *dev, int min_interval_ms, int max_interval_ms);
+int ulcd_touch_poll(ulcd_touch_poller *p);
+int ulcd_touch_get(ulcd_touch_poller *p, ulcd_event *event);
+void ulcd_touch_wait(ulcd_touch_poller *p, ulcd_event *event);
+int ulcd_touch_next_poll_ms(ulcd_touch_poller *p);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef WIDGET_H
+#define WIDGET_H
+
+#include "ulcd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Retained-mode widgets. Widgets remember their state and are only repainted
+// when it changes. Touch events are routed to widgets through a uniform grid.
+
+enum WIDGET_TYPES {
+    ULCD_WIDGET_LABEL = 0,
+    ULCD_WIDGET_BUTTON,
+    ULCD_WIDGET_GAUGE,
+    ULCD_WIDGET_CHECKBOX,
+};
+
+typedef struct ulcd_ui ulcd_ui;
+typedef struct ulcd_widget ulcd_widget;
+
+// Called when a button is clicked or a checkbox is toggled.
+typedef void (*ulcd_widget_cb)(ulcd_widget *widget, void *userdata);
+
+struct ulcd_widget {
+    ulcd_ui *ui;
+    int type;
+    uint16_t x, y, w, h;
+    char text[32];
+    int font;
+    uint16_t fg, bg;
+    int value, max;   // Gauge level, or checkbox state
+    int pressed;
+    int visible;
+    int dirty;
+    int drawn_value;
+    ulcd_widget_cb cb;
+    void *userdata;
+};
+
+ulcd_ui* ulcd_ui_create(ulcd_dev *dev, uint16_t bg);
+void ulcd_ui_free(ulcd_ui *ui);
+ulcd_widget* ulcd_ui_add(ulcd_ui *ui, int type, uint16_t x, uint16_t y, uint16_t w, uint16_t h, const char *text);
+int ulcd_ui_paint(ulcd_ui *ui);
+int ulcd_ui_dispatch(ulcd_ui *ui, const ulcd_event *event);
+void ulcd_ui_invalidate(ulcd_ui *ui);
+
+void ulcd_widget_set_text(ulcd_widget *widget, const char *text);
+void ulcd_widget_set_value(ulcd_widget *widget, int value);
+void ulcd_widget_set_range(ulcd_widget *widget, int max);
+void ulcd_widget_set_colors(ulcd_widget *widget, uint16_t fg, uint16_t bg);
+void ulcd_widget_set_font(ulcd_widget *widget, int font);
+void ulcd_widget_set_visible(ulcd_widget *widget, int visible);
+void ulcd_widget_set_callback(ulcd_widget *widget, ulcd_widget_cb cb, void *userdata);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
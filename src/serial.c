@@ -12,6 +12,10 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <linux/serial.h>
 #endif
 
 #include <stdio.h>
@@ -74,10 +78,18 @@ int serial_read(serial_port *port, char* buffer, int len) {
 int serial_write(serial_port *port, const char* buffer, int len) {
     int wrote = 0;
 #ifdef LINUX
-    wrote = write(port->handle, buffer, len);
-    if(wrote < 0) {
-        print_linux_error();
-        wrote = -1;
+    // The port is non-blocking, so keep going until the kernel has taken everything.
+    while(wrote < len) {
+        int w = write(port->handle, buffer + wrote, len - wrote);
+        if(w < 0) {
+            if(errno == EAGAIN || errno == EINTR) {
+                usleep(1000);
+                continue;
+            }
+            print_linux_error();
+            return -1;
+        }
+        wrote += w;
     }
 #else
     if(!WriteFile(port->handle, buffer, len, (PDWORD)&wrote, 0)) {
@@ -88,6 +100,244 @@ int serial_write(serial_port *port, const char* buffer, int len) {
     return wrote;
 }
 
+/**
+  * Writes several buffers to serial port in order, without joining them first. Blocks!
+  * @param port A Valid serial_port object
+  * @param chunks Buffers to write
+  * @param count Amount of buffers
+  * @return -1 on error, 0 or larger on success (written bytes).
+  */
+int serial_writev(serial_port *port, const serial_chunk *chunks, int count) {
+    int wrote = 0;
+#ifdef LINUX
+    struct iovec iov[64];
+    int first = 0;  // First chunk not completely written
+    int skip = 0;   // Bytes of it already written
+    while(first < count) {
+        int n = 0, i;
+        for(i = first; i < count && n < 64; i++, n++) {
+            iov[n].iov_base = (void*)(chunks[i].data + (i == first ? skip : 0));
+            iov[n].iov_len = chunks[i].len - (i == first ? skip : 0);
+        }
+        int w = writev(port->handle, iov, n);
+        if(w < 0) {
+            if(errno == EAGAIN || errno == EINTR) {
+                usleep(1000);
+                continue;
+            }
+            print_linux_error();
+            return -1;
+        }
+        wrote += w;
+
+        // Advance past fully written chunks
+        w += skip;
+        while(first < count && w >= chunks[first].len) {
+            w -= chunks[first].len;
+            first++;
+        }
+        skip = w;
+    }
+#else
+    int i;
+    for(i = 0; i < count; i++) {
+        int w = serial_write(port, chunks[i].data, chunks[i].len);
+        if(w < 0) {
+            return -1;
+        }
+        wrote += w;
+    }
+#endif
+    return wrote;
+}
+
+/**
+  * Waits until there is something to read.
+  * @param port A Valid serial_port object
+  * @param timeout_ms Max time to wait, -1 for forever
+  * @return 1 if data is available, 0 on timeout, -1 on error or if not supported.
+  */
+int serial_wait(serial_port *port, int timeout_ms) {
+#ifdef LINUX
+    struct pollfd pfd;
+    pfd.fd = port->handle;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, timeout_ms);
+    if(ret < 0) {
+        if(errno == EINTR) {
+            return 0;
+        }
+        print_linux_error();
+        return -1;
+    }
+    return ret > 0 ? 1 : 0;
+#else
+    return -1;
+#endif
+}
+
+/**
+  * Toggles the driver's low latency mode (ASYNC_LOW_LATENCY). On FTDI
+  * adapters this also drops the latency timer to 1ms.
+  * @param port A Valid serial_port object
+  * @param enable 1 to enable, 0 to disable
+  * @return 1 on success, 0 on failure.
+  */
+int serial_set_low_latency(serial_port *port, int enable) {
+#ifdef LINUX
+    struct serial_struct ss;
+    if(ioctl(port->handle, TIOCGSERIAL, &ss) != 0) {
+        print_linux_error();
+        return 0;
+    }
+    if(enable) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+    } else {
+        ss.flags &= ~ASYNC_LOW_LATENCY;
+    }
+    if(ioctl(port->handle, TIOCSSERIAL, &ss) != 0) {
+        print_linux_error();
+        return 0;
+    }
+    return 1;
+#else
+    sprintf(error_str, "Not supported on this platform.");
+    return 0;
+#endif
+}
+
+/**
+  * Sets the USB-serial latency timer through sysfs. Usually needs root.
+  * @param device Device name, eg. /dev/ttyUSB0
+  * @param ms Latency timer value in milliseconds, 1-255
+  * @return 1 on success, 0 on failure.
+  */
+int serial_set_latency_timer(const char* device, int ms) {
+#ifdef LINUX
+    char path[256];
+    const char *name = strrchr(device, '/');
+    name = name ? name + 1 : device;
+    snprintf(path, sizeof(path), "/sys/bus/usb-serial/devices/%s/latency_timer", name);
+
+    FILE *f = fopen(path, "w");
+    if(!f) {
+        print_linux_error();
+        return 0;
+    }
+    int ok = fprintf(f, "%d\n", ms) > 0;
+    if(fclose(f) != 0) {
+        ok = 0;
+    }
+    if(!ok) {
+        print_linux_error();
+    }
+    return ok;
+#else
+    sprintf(error_str, "Not supported on this platform.");
+    return 0;
+#endif
+}
+
+/**
+  * @return Output baud rate of the port, eg. 115200, or 0 if unknown.
+  */
+int serial_get_baud(serial_port *port) {
+#ifdef LINUX
+    struct termios tio;
+    if(tcgetattr(port->handle, &tio) != 0) {
+        return 0;
+    }
+    switch(cfgetospeed(&tio)) {
+        case B1200: return 1200;
+        case B2400: return 2400;
+        case B4800: return 4800;
+        case B9600: return 9600;
+        case B19200: return 19200;
+        case B38400: return 38400;
+        case B57600: return 57600;
+        case B115200: return 115200;
+        case B230400: return 230400;
+    }
+    return 0;
+#else
+    DCB dcb = {0};
+    dcb.DCBlength = sizeof(dcb);
+    if(!GetCommState(port->handle, &dcb)) {
+        return 0;
+    }
+    return dcb.BaudRate;
+#endif
+}
+
+#ifdef LINUX
+// Reads the first line of a sysfs attribute.
+static int read_attr(const char *path, char *buf, int len) {
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        return 0;
+    }
+    int ok = fgets(buf, len, f) != 0;
+    fclose(f);
+    if(ok) {
+        buf[strcspn(buf, "\r\n")] = 0;
+    }
+    return ok && buf[0];
+}
+#endif
+
+/**
+  * Describes the hardware behind the port, eg. "usb-0403:6001-A700fxyz" for
+  * a USB adapter (vendor, product and serial number) or "ttyS0".
+  * @return 1 on success, 0 if the port is not a known tty. buf is then "unknown".
+  */
+int serial_get_adapter(serial_port *port, char *buf, int len) {
+    snprintf(buf, len, "unknown");
+#ifdef LINUX
+    char link[256], path[512], vid[16], pid[16], serial[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", port->handle);
+    int n = readlink(path, link, sizeof(link) - 1);
+    if(n <= 0) {
+        return 0;
+    }
+    link[n] = 0;
+    const char *name = strrchr(link, '/');
+    name = name ? name + 1 : link;
+    if(strncmp(link, "/dev/", 5) != 0) {
+        return 0;
+    }
+
+    // The USB device is the parent of the tty's interface for ACM devices,
+    // one level further up for usb-serial adapters.
+    static const char *up[] = {"..", "../.."};
+    int i;
+    for(i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "/sys/class/tty/%s/device/%s/idVendor", name, up[i]);
+        if(!read_attr(path, vid, sizeof(vid))) continue;
+        snprintf(path, sizeof(path), "/sys/class/tty/%s/device/%s/idProduct", name, up[i]);
+        if(!read_attr(path, pid, sizeof(pid))) continue;
+        snprintf(path, sizeof(path), "/sys/class/tty/%s/device/%s/serial", name, up[i]);
+        if(read_attr(path, serial, sizeof(serial))) {
+            snprintf(buf, len, "usb-%s:%s-%s", vid, pid, serial);
+        } else {
+            snprintf(buf, len, "usb-%s:%s", vid, pid);
+        }
+        break;
+    }
+    if(i == 2) {
+        snprintf(buf, len, "%s", name);
+    }
+
+    // Used as a single word in files
+    for(i = 0; buf[i]; i++) {
+        if(buf[i] <= ' ') buf[i] = '_';
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 /**
   * Opens the serial port
   * @param device Device name, eg. COM1 or /dev/ttyUSB0.
@@ -0,0 +1,392 @@
+#include "ulcd_batch.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+enum {
+    CMD_CLEAR = 0,
+    CMD_PIXEL,
+    CMD_LINE,
+    CMD_RECT,
+    CMD_CIRCLE,
+    CMD_ELLIPSE,
+    CMD_TEXT,
+};
+
+typedef struct {
+    int op;
+    int pen;
+    int x0, y0, x1, y1;      // Shape parameters, as passed to the ulcd_draw_* call
+    int bx0, by0, bx1, by1;  // Bounding box on screen
+    uint16_t color;
+    int font;
+    char *text;
+    int dead;
+} batch_cmd;
+
+struct ulcd_batch {
+    ulcd_dev *dev;
+    int pen;
+    batch_cmd *cmds;
+    int count, cap;
+    long pen_calls;
+    ulcd_batch_stats stats;
+};
+
+// Helpers
+
+static int has_screen(ulcd_batch *b) {
+    return b->dev->w > 0 && b->dev->h > 0;
+}
+
+static int offscreen(ulcd_batch *b, int x0, int y0, int x1, int y1) {
+    if(!has_screen(b)) return 0;
+    return x1 < 0 || y1 < 0 || x0 >= b->dev->w || y0 >= b->dev->h;
+}
+
+static int encodable(int v) {
+    return v >= 0 && v <= 0xFFFF;
+}
+
+static batch_cmd* push(ulcd_batch *b, int op) {
+    if(b->count == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 32;
+        b->cmds = (batch_cmd*)realloc(b->cmds, sizeof(batch_cmd) * b->cap);
+    }
+    batch_cmd *c = &b->cmds[b->count++];
+    memset(c, 0, sizeof(batch_cmd));
+    c->op = op;
+    c->pen = b->pen;
+    b->stats.submitted++;
+    return c;
+}
+
+static void set_box(batch_cmd *c, int x0, int y0, int x1, int y1) {
+    c->bx0 = x0;
+    c->by0 = y0;
+    c->bx1 = x1;
+    c->by1 = y1;
+}
+
+// Cohen-Sutherland line clipping against the screen.
+static int outcode(ulcd_batch *b, int x, int y) {
+    int code = 0;
+    if(x < 0) code |= 1;
+    else if(x >= b->dev->w) code |= 2;
+    if(y < 0) code |= 4;
+    else if(y >= b->dev->h) code |= 8;
+    return code;
+}
+
+static int clip_line(ulcd_batch *b, int *x0, int *y0, int *x1, int *y1) {
+    int c0 = outcode(b, *x0, *y0), c1 = outcode(b, *x1, *y1);
+    int xmax = b->dev->w - 1, ymax = b->dev->h - 1;
+    for(;;) {
+        if(!(c0 | c1)) return 1;
+        if(c0 & c1) return 0;
+        int c = c0 ? c0 : c1;
+        long x = 0, y = 0;
+        long dx = *x1 - *x0, dy = *y1 - *y0;
+        if(c & 8) {
+            x = *x0 + dx * (ymax - *y0) / dy;
+            y = ymax;
+        } else if(c & 4) {
+            x = *x0 + dx * (0 - *y0) / dy;
+            y = 0;
+        } else if(c & 2) {
+            y = *y0 + dy * (xmax - *x0) / dx;
+            x = xmax;
+        } else {
+            y = *y0 + dy * (0 - *x0) / dx;
+            x = 0;
+        }
+        if(c == c0) {
+            *x0 = x;
+            *y0 = y;
+            c0 = outcode(b, *x0, *y0);
+        } else {
+            *x1 = x;
+            *y1 = y;
+            c1 = outcode(b, *x1, *y1);
+        }
+    }
+}
+
+static int inside(const batch_cmd *c, const batch_cmd *cover) {
+    return c->bx0 >= cover->bx0 && c->by0 >= cover->by0
+        && c->bx1 <= cover->bx1 && c->by1 <= cover->by1;
+}
+
+static int opaque(const batch_cmd *c) {
+    return c->op == CMD_CLEAR || (c->op == CMD_RECT && c->pen == ULCD_PEN_SOLID);
+}
+
+// Recording
+
+/**
+  * Creates a batch for a device. Drawing through the batch is only sent when
+  * ulcd_batch_flush() is called.
+  */
+ulcd_batch* ulcd_batch_create(ulcd_dev *dev) {
+    ulcd_batch *b = (ulcd_batch*)calloc(1, sizeof(ulcd_batch));
+    b->dev = dev;
+    b->pen = (dev->pen >= 0) ? dev->pen : ULCD_PEN_SOLID;
+    return b;
+}
+
+static void clear_cmds(ulcd_batch *b) {
+    int i;
+    for(i = 0; i < b->count; i++) {
+        free(b->cmds[i].text);
+    }
+    b->count = 0;
+}
+
+void ulcd_batch_free(ulcd_batch *b) {
+    if(b == 0) return;
+    clear_cmds(b);
+    free(b->cmds);
+    free(b);
+}
+
+void ulcd_batch_pen_style(ulcd_batch *b, int style) {
+    b->pen = style;
+    b->pen_calls++;
+}
+
+void ulcd_batch_clear(ulcd_batch *b) {
+    int i;
+    for(i = 0; i < b->count; i++) {
+        if(!b->cmds[i].dead) {
+            b->cmds[i].dead = 1;
+            b->stats.overdrawn++;
+        }
+    }
+    batch_cmd *c = push(b, CMD_CLEAR);
+    set_box(c, 0, 0, 0x7FFF, 0x7FFF);
+}
+
+void ulcd_batch_pixel(ulcd_batch *b, int x, int y, uint16_t color) {
+    if(offscreen(b, x, y, x, y) || !encodable(x) || !encodable(y)) {
+        b->stats.submitted++;
+        b->stats.culled++;
+        return;
+    }
+    batch_cmd *c = push(b, CMD_PIXEL);
+    c->x0 = x;
+    c->y0 = y;
+    c->color = color;
+    set_box(c, x, y, x, y);
+}
+
+void ulcd_batch_line(ulcd_batch *b, int x0, int y0, int x1, int y1, uint16_t color) {
+    if(has_screen(b) && !clip_line(b, &x0, &y0, &x1, &y1)) {
+        b->stats.submitted++;
+        b->stats.culled++;
+        return;
+    }
+    if(!encodable(x0) || !encodable(y0) || !encodable(x1) || !encodable(y1)) {
+        b->stats.submitted++;
+        b->stats.culled++;
+        return;
+    }
+    batch_cmd *c = push(b, CMD_LINE);
+    c->x0 = x0;
+    c->y0 = y0;
+    c->x1 = x1;
+    c->y1 = y1;
+    c->color = color;
+    set_box(c, x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, x0 > x1 ? x0 : x1, y0 > y1 ? y0 : y1);
+}
+
+void ulcd_batch_rect(ulcd_batch *b, int x0, int y0, int x1, int y1, uint16_t color) {
+    int t;
+    if(x0 > x1) { t = x0; x0 = x1; x1 = t; }
+    if(y0 > y1) { t = y0; y0 = y1; y1 = t; }
+    if(offscreen(b, x0, y0, x1, y1)) {
+        b->stats.submitted++;
+        b->stats.culled++;
+        return;
+    }
+
+    if(has_screen(b)) {
+        int xmax = b->dev->w - 1, ymax = b->dev->h - 1;
+        int clipped = x0 < 0 || y0 < 0 || x1 > xmax || y1 > ymax;
+        if(clipped && b->pen != ULCD_PEN_SOLID) {
+            // An outline can't be clipped as a rectangle, so draw what is left
+            // of its edges as lines.
+            ulcd_batch_line(b, x0, y0, x1, y0, color);
+            ulcd_batch_line(b, x0, y1, x1, y1, color);
+            ulcd_batch_line(b, x0, y0, x0, y1, color);
+            ulcd_batch_line(b, x1, y0, x1, y1, color);
+            b->stats.submitted -= 3;
+            return;
+        }
+        if(x0 < 0) x0 = 0;
+        if(y0 < 0) y0 = 0;
+        if(x1 > xmax) x1 = xmax;
+        if(y1 > ymax) y1 = ymax;
+    }
+    if(!encodable(x0) || !encodable(y0) || !encodable(x1) || !encodable(y1)) {
+        b->stats.submitted++;
+        b->stats.culled++;
+        return;
+    }
+
+    batch_cmd *c = push(b, CMD_RECT);
+    c->x0 = x0;
+    c->y0 = y0;
+    c->x1 = x1;
+    c->y1 = y1;
+    c->color = color;
+    set_box(c, x0, y0, x1, y1);
+}
+
+static void record_ellipse(ulcd_batch *b, int op, int x, int y, int xrad, int yrad, uint16_t color) {
+    // The centre has to be encodable, so shapes centred off the top or left
+    // edge are dropped even if part of them would show.
+    if(offscreen(b, x - xrad, y - yrad, x + xrad, y + yrad)
+       || !encodable(x) || !encodable(y) || xrad < 0 || yrad < 0) {
+        b->stats.submitted++;
+        b->stats.culled++;
+        return;
+    }
+    batch_cmd *c = push(b, op);
+    c->x0 = x;
+    c->y0 = y;
+    c->x1 = xrad;
+    c->y1 = yrad;
+    c->color = color;
+    set_box(c, x - xrad, y - yrad, x + xrad, y + yrad);
+}
+
+void ulcd_batch_ellipse(ulcd_batch *b, int x, int y, int xrad, int yrad, uint16_t color) {
+    record_ellipse(b, CMD_ELLIPSE, x, y, xrad, yrad, color);
+}
+
+void ulcd_batch_circle(ulcd_batch *b, int x, int y, int radius, uint16_t color) {
+    record_ellipse(b, CMD_CIRCLE, x, y, radius, radius, color);
+}
+
+void ulcd_batch_text(ulcd_batch *b, const char *text, int x, int y, int font, uint16_t color) {
+    int cw, h;
+    if(!ulcd_text_metrics(font, &cw, &h)) {
+        font = 0;
+        ulcd_text_metrics(font, &cw, &h);
+    }
+    int len = strlen(text);
+    int w = len * cw;
+    if(len == 0 || offscreen(b, x, y, x + w - 1, y + h - 1) || !encodable(x) || !encodable(y)) {
+        b->stats.submitted++;
+        b->stats.culled++;
+        return;
+    }
+    batch_cmd *c = push(b, CMD_TEXT);
+    c->x0 = x;
+    c->y0 = y;
+    c->font = font;
+    c->color = color;
+    c->text = (char*)malloc(len + 1);
+    memcpy(c->text, text, len + 1);
+    set_box(c, x, y, x + w - 1, y + h - 1);
+}
+
+// Optimising and sending
+
+static void drop_overdrawn(ulcd_batch *b) {
+    int i, j;
+    for(i = b->count - 1; i >= 0; i--) {
+        batch_cmd *c = &b->cmds[i];
+        if(c->dead) continue;
+        for(j = i + 1; j < b->count; j++) {
+            batch_cmd *cover = &b->cmds[j];
+            if(!cover->dead && opaque(cover) && inside(c, cover)) {
+                c->dead = 1;
+                b->stats.overdrawn++;
+                break;
+            }
+        }
+    }
+}
+
+// Merges runs of solid rectangles of one colour that together form a rectangle.
+static void merge_rects(ulcd_batch *b) {
+    int i, prev = -1;
+    for(i = 0; i < b->count; i++) {
+        batch_cmd *c = &b->cmds[i];
+        if(c->dead) continue;
+        if(prev >= 0) {
+            batch_cmd *p = &b->cmds[prev];
+            if(p->op == CMD_RECT && c->op == CMD_RECT
+               && p->pen == ULCD_PEN_SOLID && c->pen == ULCD_PEN_SOLID
+               && p->color == c->color) {
+                int vertical = p->x0 == c->x0 && p->x1 == c->x1
+                            && c->y0 <= p->y1 + 1 && p->y0 <= c->y1 + 1;
+                int horizontal = p->y0 == c->y0 && p->y1 == c->y1
+                              && c->x0 <= p->x1 + 1 && p->x0 <= c->x1 + 1;
+                if(vertical || horizontal) {
+                    if(c->x0 < p->x0) p->x0 = c->x0;
+                    if(c->y0 < p->y0) p->y0 = c->y0;
+                    if(c->x1 > p->x1) p->x1 = c->x1;
+                    if(c->y1 > p->y1) p->y1 = c->y1;
+                    set_box(p, p->x0, p->y0, p->x1, p->y1);
+                    c->dead = 1;
+                    b->stats.merged++;
+                    continue;
+                }
+            }
+        }
+        prev = i;
+    }
+}
+
+static int send_cmd(ulcd_batch *b, batch_cmd *c) {
+    ulcd_dev *dev = b->dev;
+    if(c->op == CMD_RECT || c->op == CMD_CIRCLE || c->op == CMD_ELLIPSE) {
+        if(dev->pen != c->pen) {
+            b->stats.pen_changes++;
+            if(!ulcd_pen_style(dev, c->pen)) {
+                return 0;
+            }
+        }
+    }
+    b->stats.sent++;
+    switch(c->op) {
+        case CMD_CLEAR: return ulcd_clear(dev);
+        case CMD_PIXEL: return ulcd_draw_pixel(dev, c->x0, c->y0, c->color);
+        case CMD_LINE: return ulcd_draw_line(dev, c->x0, c->y0, c->x1, c->y1, c->color);
+        case CMD_RECT: return ulcd_draw_rect(dev, c->x0, c->y0, c->x1, c->y1, c->color);
+        case CMD_CIRCLE: return ulcd_draw_circle(dev, c->x0, c->y0, c->x1, c->color);
+        case CMD_ELLIPSE: return ulcd_draw_ellipse(dev, c->x0, c->y0, c->x1, c->y1, c->color);
+        case CMD_TEXT: return ulcd_draw_text(dev, c->text, c->x0, c->y0, c->font, c->color);
+    }
+    return 1;
+}
+
+/**
+  * Optimises and sends everything recorded since the last flush.
+  * @return 1 on success, 0 if any command failed.
+  */
+int ulcd_batch_flush(ulcd_batch *b) {
+    int i, ok = 1;
+    drop_overdrawn(b);
+    merge_rects(b);
+    for(i = 0; i < b->count; i++) {
+        if(!b->cmds[i].dead) {
+            ok &= send_cmd(b, &b->cmds[i]);
+        }
+    }
+    clear_cmds(b);
+    return ok;
+}
+
+void ulcd_batch_get_stats(ulcd_batch *b, ulcd_batch_stats *stats) {
+    *stats = b->stats;
+    stats->pen_skipped = b->pen_calls - b->stats.pen_changes;
+    if(stats->pen_skipped < 0) {
+        stats->pen_skipped = 0;
+    }
+}
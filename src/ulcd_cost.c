@@ -0,0 +1,422 @@
+#include "ulcd_cost.h"
+#include "serial.h"
+
+#ifdef LINUX
+#include <time.h>
+#endif
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+#define COST_MAGIC "ulcd-cost-2"
+
+/**
+  * @return Bytes sent for a command of the given size.
+  */
+int ulcd_cost_bytes(int op, double units) {
+    switch(op) {
+        case ULCD_OP_CLEAR: return 1;
+        case ULCD_OP_PIXEL: return 7;
+        case ULCD_OP_LINE: return 11;
+        case ULCD_OP_RECT: return 11;
+        case ULCD_OP_CIRCLE: return 9;
+        case ULCD_OP_ELLIPSE: return 11;
+        case ULCD_OP_TEXT: return 11 + (int)units;
+        case ULCD_OP_BLIT: return 10 + 2 * (int)units;
+    }
+    return 0;
+}
+
+// Calibration
+
+static void set_identity(ulcd_dev *dev, ulcd_cost_model *model) {
+    model->type = dev->type;
+    model->hw_ver = dev->hw_ver;
+    model->sw_ver = dev->sw_ver;
+    model->w = dev->w;
+    model->h = dev->h;
+    model->baud = serial_get_baud(dev->port);
+    serial_get_adapter(dev->port, model->link, sizeof(model->link));
+}
+
+#ifdef LINUX
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/**
+  * Times the link round trip with the autobaud command, which has no side
+  * effects.
+  * @return 1 on success, 0 on failure.
+  */
+static int measure_rtt(ulcd_dev *dev, int reps, double *rtt_ms) {
+    char c = 0x55;
+    int i;
+    double t0 = now_ms();
+    for(i = 0; i < reps; i++) {
+        if(!ulcd_send_command(dev, &c, 1)) {
+            return 0;
+        }
+    }
+    *rtt_ms = (now_ms() - t0) / reps;
+    return 1;
+}
+
+// Runs one command of the given size. Sizes are kept on the screen by the
+// caller.
+static int run_op(ulcd_dev *dev, int op, int n, const char *data, const char *text) {
+    int cx = dev->w / 2, cy = dev->h / 2;
+    switch(op) {
+        case ULCD_OP_CLEAR: return ulcd_clear(dev);
+        case ULCD_OP_PIXEL: return ulcd_draw_pixel(dev, cx, cy, 0xFFFF);
+        case ULCD_OP_LINE: return ulcd_draw_line(dev, 0, 0, n - 1, n - 1, 0xFFFF);
+        case ULCD_OP_RECT: return ulcd_draw_rect(dev, 0, 0, n - 1, n - 1, 0xFFFF);
+        case ULCD_OP_CIRCLE: return ulcd_draw_circle(dev, cx, cy, n, 0xFFFF);
+        case ULCD_OP_ELLIPSE: return ulcd_draw_ellipse(dev, cx, cy, n, n / 2 + 1, 0xFFFF);
+        case ULCD_OP_TEXT: return ulcd_draw_text(dev, text + strlen(text) - n, 0, 0, 0, 0xFFFF);
+        case ULCD_OP_BLIT: return ulcd_blit(dev, 0, 0, n, n, data);
+    }
+    return 0;
+}
+
+static double op_units(int op, int n) {
+    switch(op) {
+        case ULCD_OP_LINE: return n;
+        case ULCD_OP_RECT: return (double)n * n;
+        case ULCD_OP_CIRCLE: return (double)n * n;
+        case ULCD_OP_ELLIPSE: return (double)n * (n / 2 + 1);
+        case ULCD_OP_TEXT: return n;
+        case ULCD_OP_BLIT: return (double)n * n;
+    }
+    return 0;
+}
+
+// Average time of reps commands, in ms.
+static int time_op(ulcd_dev *dev, int op, int n, int reps, const char *data, const char *text, double *ms) {
+    int i;
+    double t0 = now_ms();
+    for(i = 0; i < reps; i++) {
+        if(!run_op(dev, op, n, data, text)) {
+            return 0;
+        }
+    }
+    *ms = (now_ms() - t0) / reps;
+    return 1;
+}
+
+// Least squares fit of y = base + unit * x. Negative terms are clamped to 0.
+static void fit(const double *x, const double *y, int n, ulcd_op_cost *out) {
+    double mx = 0, my = 0, sxx = 0, sxy = 0;
+    int i;
+    for(i = 0; i < n; i++) {
+        mx += x[i];
+        my += y[i];
+    }
+    mx /= n;
+    my /= n;
+    for(i = 0; i < n; i++) {
+        sxx += (x[i] - mx) * (x[i] - mx);
+        sxy += (x[i] - mx) * (y[i] - my);
+    }
+    out->unit_ms = (sxx > 0) ? sxy / sxx : 0;
+    if(out->unit_ms < 0) out->unit_ms = 0;
+    out->base_ms = my - out->unit_ms * mx;
+    if(out->base_ms < 0) out->base_ms = 0;
+}
+
+/**
+  * Measures the cost of every command on the attached panel. The screen is
+  * drawn over and cleared afterwards. Takes a few seconds at low baud rates.
+  * @param reps Repetitions per measurement, more gives a steadier fit
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_cost_calibrate(ulcd_dev *dev, int reps, ulcd_cost_model *model) {
+    int side = dev->w < dev->h ? dev->w : dev->h;
+    if(side < 4) {
+        sprintf(errorstr, "Unknown screen size, can't calibrate.");
+        return 0;
+    }
+    if(reps < 1) reps = 1;
+
+    memset(model, 0, sizeof(ulcd_cost_model));
+    set_identity(dev, model);
+
+    if(!ulcd_pen_style(dev, ULCD_PEN_SOLID)) {
+        return 0;
+    }
+
+    int j;
+    if(!measure_rtt(dev, reps, &model->rtt_ms)) {
+        return 0;
+    }
+
+    // Sizes per command, each clamped to the screen below
+    int sizes[ULCD_OP_COUNT][5] = {
+        {0, 0, 0, 0, 0},             // Clear
+        {0, 0, 0, 0, 0},             // Pixel
+        {1, 16, 64, side / 2, side}, // Line
+        {1, 8, 32, side / 2, side},  // Rect
+        {1, 8, 32, side / 4, side / 2 - 1}, // Circle
+        {1, 8, 32, side / 4, side / 2 - 1}, // Ellipse
+        {1, 4, 8, 16, dev->w / 6},   // Text, 6 pixels per character in font 0
+        {1, 8, 32, 64, side / 2},    // Blit
+    };
+
+    char *data = (char*)calloc(side * side, 2);
+    char text[256];
+    int maxtext = dev->w / 6 < 255 ? dev->w / 6 : 255;
+    memset(text, 'M', maxtext);
+    text[maxtext] = 0;
+
+    // Blits go first: they are limited by the link, so they give the wire
+    // time per byte to take out of the other commands.
+    static const int order[ULCD_OP_COUNT] = {
+        ULCD_OP_BLIT, ULCD_OP_CLEAR, ULCD_OP_PIXEL, ULCD_OP_LINE,
+        ULCD_OP_RECT, ULCD_OP_CIRCLE, ULCD_OP_ELLIPSE, ULCD_OP_TEXT,
+    };
+    int k, ok = 1;
+    for(k = 0; k < ULCD_OP_COUNT && ok; k++) {
+        int op = order[k];
+        double x[5], y[5];
+        int n = 0;
+        for(j = 0; j < 5; j++) {
+            int s = sizes[op][j];
+            if(op == ULCD_OP_TEXT) {
+                if(s > maxtext) s = maxtext;
+            } else if(s > side) {
+                s = side;
+            }
+            if(op != ULCD_OP_CLEAR && op != ULCD_OP_PIXEL && s < 1) continue;
+
+            double ms;
+            if(!time_op(dev, op, s, reps, data, text, &ms)) {
+                ok = 0;
+                break;
+            }
+            double units = op_units(op, s);
+            int bytes = ulcd_cost_bytes(op, units);
+            if(op == ULCD_OP_BLIT) {
+                x[n] = bytes;
+                y[n] = ms - model->rtt_ms;
+            } else {
+                x[n] = units;
+                y[n] = ms - model->rtt_ms - bytes * model->byte_ms;
+            }
+            n++;
+        }
+        if(!ok) break;
+
+        if(op == ULCD_OP_BLIT) {
+            // The slope is the wire time per byte, what is left is the fixed
+            // cost of a blit.
+            ulcd_op_cost wire;
+            fit(x, y, n, &wire);
+            model->byte_ms = wire.unit_ms;
+            model->ops[op].base_ms = wire.base_ms;
+            model->ops[op].unit_ms = 0;
+        } else {
+            fit(x, y, n, &model->ops[op]);
+        }
+    }
+    free(data);
+
+    return ok && ulcd_clear(dev);
+}
+
+#else
+
+int ulcd_cost_calibrate(ulcd_dev *dev, int reps, ulcd_cost_model *model) {
+    sprintf(errorstr, "Calibration is only supported on Linux.");
+    return 0;
+}
+
+#endif // LINUX
+
+// Persistence
+
+static int parse_model(const char *line, ulcd_cost_model *m) {
+    char magic[16];
+    int pos = 0, i;
+    memset(m, 0, sizeof(ulcd_cost_model));
+    if(sscanf(line, "%15s %d %d %d %d %d %d %47s %lf %lf%n", magic, &m->type, &m->hw_ver,
+              &m->sw_ver, &m->w, &m->h, &m->baud, m->link, &m->rtt_ms, &m->byte_ms, &pos) != 10
+       || strcmp(magic, COST_MAGIC) != 0) {
+        return 0;
+    }
+    for(i = 0; i < ULCD_OP_COUNT; i++) {
+        int used = 0;
+        if(sscanf(line + pos, "%lf %lf%n", &m->ops[i].base_ms, &m->ops[i].unit_ms, &used) != 2) {
+            return 0;
+        }
+        pos += used;
+    }
+    return 1;
+}
+
+static int same_device(const ulcd_cost_model *a, const ulcd_cost_model *b) {
+    return a->type == b->type && a->hw_ver == b->hw_ver && a->sw_ver == b->sw_ver
+        && a->w == b->w && a->h == b->h && a->baud == b->baud
+        && strcmp(a->link, b->link) == 0;
+}
+
+/**
+  * Loads the model saved for this panel and serial link, and measures the
+  * link round trip again.
+  * @return 1 if found, 0 otherwise.
+  */
+int ulcd_cost_load(ulcd_dev *dev, const char *file, ulcd_cost_model *model) {
+    FILE *f = fopen(file, "r");
+    if(!f) {
+        sprintf(errorstr, "Could not open cost model file.");
+        return 0;
+    }
+
+    ulcd_cost_model want, m;
+    memset(&want, 0, sizeof(want));
+    set_identity(dev, &want);
+
+    char line[1024];
+    while(fgets(line, sizeof(line), f)) {
+        if(parse_model(line, &m) && same_device(&m, &want)) {
+            fclose(f);
+#ifdef LINUX
+            // The round trip depends on the adapter's latency settings too,
+            // which may have changed since calibration.
+            if(!measure_rtt(dev, 3, &m.rtt_ms)) {
+                return 0;
+            }
+#endif
+            *model = m;
+            return 1;
+        }
+    }
+    fclose(f);
+    sprintf(errorstr, "No cost model for this device.");
+    return 0;
+}
+
+/**
+  * Saves a model, replacing any earlier model for the same device. Models
+  * for other devices in the file are kept.
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_cost_save(const ulcd_cost_model *model, const char *file) {
+    char line[1024];
+    char *keep = 0;
+    int keeplen = 0;
+
+    FILE *f = fopen(file, "r");
+    if(f) {
+        ulcd_cost_model m;
+        while(fgets(line, sizeof(line), f)) {
+            if(parse_model(line, &m) && same_device(&m, model)) continue;
+            int len = strlen(line);
+            keep = (char*)realloc(keep, keeplen + len);
+            memcpy(keep + keeplen, line, len);
+            keeplen += len;
+        }
+        fclose(f);
+    }
+
+    f = fopen(file, "w");
+    if(!f) {
+        free(keep);
+        sprintf(errorstr, "Could not write cost model file.");
+        return 0;
+    }
+    if(keeplen > 0) {
+        fwrite(keep, 1, keeplen, f);
+    }
+    free(keep);
+
+    fprintf(f, "%s %d %d %d %d %d %d %s %.6f %.9f", COST_MAGIC, model->type, model->hw_ver,
+            model->sw_ver, model->w, model->h, model->baud, model->link[0] ? model->link : "unknown",
+            model->rtt_ms, model->byte_ms);
+    int i;
+    for(i = 0; i < ULCD_OP_COUNT; i++) {
+        fprintf(f, " %.6f %.9f", model->ops[i].base_ms, model->ops[i].unit_ms);
+    }
+    fprintf(f, "\n");
+    if(fclose(f) != 0) {
+        sprintf(errorstr, "Could not write cost model file.");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+  * Loads the model for this panel, calibrating and saving it first if the
+  * file has none. Calibration draws over the screen.
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_cost_init(ulcd_dev *dev, const char *file, ulcd_cost_model *model) {
+    if(ulcd_cost_load(dev, file, model)) {
+        return 1;
+    }
+    if(!ulcd_cost_calibrate(dev, 3, model)) {
+        return 0;
+    }
+    return ulcd_cost_save(model, file);
+}
+
+// Estimates
+
+/**
+  * @param units Command size, see COST_OPS
+  * @return Estimated time in ms from sending a command to its acknowledge.
+  */
+double ulcd_cost_estimate(const ulcd_cost_model *model, int op, double units) {
+    if(op < 0 || op >= ULCD_OP_COUNT) {
+        return 0;
+    }
+    const ulcd_op_cost *c = &model->ops[op];
+    return model->rtt_ms + ulcd_cost_bytes(op, units) * model->byte_ms
+         + c->base_ms + c->unit_ms * units;
+}
+
+double ulcd_cost_rect(const ulcd_cost_model *model, int w, int h) {
+    return ulcd_cost_estimate(model, ULCD_OP_RECT, (double)w * h);
+}
+
+double ulcd_cost_blit(const ulcd_cost_model *model, int w, int h) {
+    return ulcd_cost_estimate(model, ULCD_OP_BLIT, (double)w * h);
+}
+
+/**
+  * @return Rows of a w pixel wide blit that fit in budget_ms, at least 1.
+  */
+int ulcd_cost_blit_rows(const ulcd_cost_model *model, int w, double budget_ms) {
+    int limit = model->h > 0 ? model->h : 0xFFFF;
+    double fixed = ulcd_cost_blit(model, 0, 0);
+    double row = ulcd_cost_blit(model, w, 1) - fixed;
+    if(row <= 0) {
+        return limit;
+    }
+    double rows = (budget_ms - fixed) / row;
+    if(rows < 1) return 1;
+    if(rows > limit) return limit;
+    return (int)rows;
+}
+
+/**
+  * Rows of blit data that take less time to send than the fixed cost of a
+  * separate blit are worth sending along with their neighbours, see
+  * ulcd_row_merge.
+  * @return That many bytes, or 0 if the model has no link timings.
+  */
+int ulcd_cost_merge_bytes(const ulcd_cost_model *model) {
+    double per_byte = model->byte_ms + model->ops[ULCD_OP_BLIT].unit_ms / 2;
+    if(per_byte <= 0) {
+        return 0;
+    }
+    double bytes = ulcd_cost_blit(model, 0, 0) / per_byte;
+    if(bytes < 1) return 1;
+    if(bytes > 1 << 24) return 1 << 24;
+    return (int)(bytes + 0.5);
+}
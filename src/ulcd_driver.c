@@ -3,6 +3,7 @@
 
 #ifdef LINUX
 #include <unistd.h>
+#include <time.h>
 #else
 #include <windows.h>
 #endif
@@ -15,26 +16,77 @@ char errorstr[256];
 
 // Helper functions for serial port stuff
 
-unsigned char read_char(ulcd_dev *dev) {
-    unsigned char c;
-    while(serial_read(dev->port, (char*)&c, 1) <= 0) {
+enum {
+    RESULT_ACK = 0,
+    RESULT_NAK,
+    RESULT_TIMEOUT,
+    RESULT_STRAY,
+};
+
+void sleep_ms(int ms) {
 #ifdef LINUX
-        usleep(1000);
+    usleep(ms * 1000);
 #else
-        Sleep(1);
+    Sleep(ms);
 #endif
+}
+
+// Reads one byte. Returns -1 if nothing arrives within timeout_ms (0 = forever).
+int read_char_timeout(ulcd_dev *dev, int timeout_ms) {
+    unsigned char c;
+#ifdef LINUX
+    // Block in poll() rather than sleeping, so a reply is seen as soon as it arrives.
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(serial_read(dev->port, (char*)&c, 1) <= 0) {
+        int left = -1;
+        if(timeout_ms > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+            if(left <= 0) {
+                return -1;
+            }
+        }
+        if(serial_wait(dev->port, left) < 0) {
+            sleep_ms(1);
+        }
     }
+#else
+    int waited = 0;
+    while(serial_read(dev->port, (char*)&c, 1) <= 0) {
+        if(timeout_ms > 0 && waited >= timeout_ms) {
+            return -1;
+        }
+        sleep_ms(1);
+        waited++;
+    }
+#endif
     return c;
 }
 
+int read_char(ulcd_dev *dev) {
+    return read_char_timeout(dev, dev->timeout);
+}
+
 void write_char(ulcd_dev *dev, unsigned char c) {
     serial_write(dev->port, (char*)&c, 1);
 }
 
-uint16_t read_word(ulcd_dev *dev) {
-    uint16_t result;
-    result = (read_char(dev) << 8) | read_char(dev);
-    return result;
+// Reads a big-endian word. On timeout the link is resynced, since the rest
+// of the reply may still arrive, and -1 is returned.
+int read_word_timeout(ulcd_dev *dev, int timeout_ms) {
+    int hi = read_char_timeout(dev, timeout_ms);
+    int lo = (hi < 0) ? -1 : read_char_timeout(dev, timeout_ms);
+    if(hi < 0 || lo < 0) {
+        sprintf(errorstr, "Timeout while reading reply.");
+        ulcd_resync(dev);
+        return -1;
+    }
+    return (hi << 8) | lo;
+}
+
+int read_word(ulcd_dev *dev) {
+    return read_word_timeout(dev, dev->timeout);
 }
 
 void write_word(ulcd_dev *dev, uint16_t word) {
@@ -44,12 +96,87 @@ void write_word(ulcd_dev *dev, uint16_t word) {
     serial_write(dev->port, buf, 2);
 }
 
+// Throws away input until the line has been quiet for a while.
+void drain_input(ulcd_dev *dev) {
+    char tmp[256];
+    int quiet = 0;
+    while(quiet < 20) {
+        if(serial_read(dev->port, tmp, sizeof(tmp)) > 0) {
+            quiet = 0;
+        } else {
+            sleep_ms(1);
+            quiet++;
+        }
+    }
+}
+
+int read_result(ulcd_dev *dev) {
+    int c = read_char(dev);
+    if(c == 0x06) return RESULT_ACK;
+    if(c == 0x15) return RESULT_NAK;
+    if(c < 0) return RESULT_TIMEOUT;
+    return RESULT_STRAY;
+}
+
+const char* result_str(int result) {
+    switch(result) {
+        case RESULT_NAK: return "NAK";
+        case RESULT_TIMEOUT: return "timeout";
+        case RESULT_STRAY: return "unexpected reply";
+    }
+    return "ok";
+}
+
+/**
+  * Gets the link back into a known state after a timeout or garbage reply.
+  * Drains pending input and repeats the autobaud handshake until the panel ACKs.
+  * @return 1 on success, 0 if the panel did not respond.
+  */
+int ulcd_resync(ulcd_dev *dev) {
+    int i;
+    for(i = 0; i < 4; i++) {
+        drain_input(dev);
+        write_char(dev, 0x55);
+        if(read_char_timeout(dev, 100) == 0x06) {
+            drain_input(dev);
+            // The panel may have reset, so its pen style is unknown.
+            dev->pen = -1;
+            return 1;
+        }
+    }
+    sprintf(errorstr, "Could not resynchronize with panel.");
+    return 0;
+}
+
 int check_result(ulcd_dev *dev, const char* errtext) {
-    if(read_char(dev) != 0x06) {
-        memcpy(errorstr, errtext, strlen(errtext));
-        return 0;
+    int result = read_result(dev);
+    if(result == RESULT_ACK) {
+        return 1;
     }
-    return 1;
+    if(result != RESULT_NAK) {
+        ulcd_resync(dev);
+    }
+    snprintf(errorstr, sizeof(errorstr), "%s (%s)", errtext, result_str(result));
+    return 0;
+}
+
+// Sends an idempotent command (header + optional body) and checks the result.
+// On failure the command is retried up to dev->retries times.
+int send_checked(ulcd_dev *dev,
+                 const char *head, int head_len,
+                 const char *body, int body_len,
+                 const char *errtext) {
+    int attempt;
+    for(attempt = 0; attempt <= dev->retries; attempt++) {
+        serial_write(dev->port, head, head_len);
+        if(body_len > 0) {
+            serial_write(dev->port, body, body_len);
+        }
+        if(check_result(dev, errtext)) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 // Helper functions for interpreting the display stuff
@@ -95,13 +222,21 @@ ulcd_dev* ulcd_init(const char* device) {
 
     // Allocate memory
     ulcd_dev *dev = (ulcd_dev*)malloc(sizeof(ulcd_dev));
+    if(!dev) {
+        sprintf(errorstr, "Out of memory.");
+        serial_close(ser);
+        return 0;
+    }
     dev->port = ser;
+    dev->timeout = 1000;
+    dev->retries = 2;
+    dev->pen = -1;
     memset(dev->name, 0, 16);
 
     // Init panel
     write_char(dev, 0x55);
     if(!check_result(dev, "Panel initialization failed.")) {
-        free(dev);
+        ulcd_close(dev);
         return 0;
     }
 
@@ -111,6 +246,11 @@ ulcd_dev* ulcd_init(const char* device) {
 
     // Read version information
     dev->type = read_char(dev);
+    if(dev->type < 0) {
+        sprintf(errorstr, "Version information request timed out.");
+        ulcd_close(dev);
+        return 0;
+    }
     dev->hw_ver = read_char(dev) - 6;
     dev->sw_ver = read_char(dev) - 6;
     dev->w = get_res_by_code(read_char(dev));
@@ -122,7 +262,7 @@ ulcd_dev* ulcd_init(const char* device) {
     write_char(dev, 0x05);
     write_char(dev, 0x02);
     if(!check_result(dev, "Touch region reset failed.")) {
-        free(dev);
+        ulcd_close(dev);
         return 0;
     }
 
@@ -131,7 +271,7 @@ ulcd_dev* ulcd_init(const char* device) {
     write_char(dev, 0x05);
     write_char(dev, 0x00);
     if(!check_result(dev, "Enabling touch events failed.")) {
-        free(dev);
+        ulcd_close(dev);
         return 0;
     }
 
@@ -146,14 +286,35 @@ void ulcd_close(ulcd_dev *dev) {
 }
 
 int ulcd_clear(ulcd_dev *dev) {
-    write_char(dev, 0x45);
-    return check_result(dev, "Clear screen failed.");
+    char c = 0x45;
+    return send_checked(dev, &c, 1, 0, 0, "Clear screen failed.");
+}
+
+/**
+  * Sets how long to wait for a reply from the panel, and how many times
+  * idempotent commands (drawing etc.) are retried after a failure.
+  * @param timeout_ms Reply timeout, 0 to wait forever
+  */
+void ulcd_set_timeout(ulcd_dev *dev, int timeout_ms, int retries) {
+    dev->timeout = timeout_ms;
+    dev->retries = (retries < 0) ? 0 : retries;
 }
 
 char* ulcd_get_error_str() {
     return errorstr;
 }
 
+/**
+  * Sends a pre-encoded command and waits for the ACK. The command is retried
+  * on failure like the built-in drawing commands, so it must be safe to repeat.
+  * @param cmd Complete command bytes, opcode first
+  * @param len Length of the command
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_send_command(ulcd_dev *dev, const char *cmd, int len) {
+    return send_checked(dev, cmd, len, 0, 0, "Command failed.");
+}
+
 int ulcd_toggle_power(ulcd_dev *dev, int toggle) {
     write_char(dev, 0x59);
     write_char(dev, 0x03);
@@ -168,48 +329,67 @@ int ulcd_toggle_backlight(ulcd_dev *dev, int toggle) {
     return check_result(dev, "Backlight toggling failed.");
 }
 
+/**
+  * Polls the touch screen. If the panel does not answer within dev->timeout,
+  * the link is resynced and the event is returned as ULCD_NO_ACTIVITY.
+  */
 void ulcd_get_event(ulcd_dev *dev, ulcd_event *event) {
+    event->type = ULCD_NO_ACTIVITY;
+    event->x = -1;
+    event->y = -1;
+
     // Get type
     write_char(dev, 0x6F);
     write_char(dev, 0x04);
-    event->type = read_word(dev);
-    read_word(dev);
+    int type = read_word(dev);
+    if(type < 0 || read_word(dev) < 0) {
+        return;
+    }
 
     // If type is valid, get coords
-    if(event->type > 0) {
+    if(type > 0) {
         write_char(dev, 0x6F);
         write_char(dev, 0x05);
-        event->x = read_word(dev);
-        event->y = read_word(dev);
-    } else {
-        event->x = -1;
-        event->y = -1;
+        int x = read_word(dev);
+        int y = (x < 0) ? -1 : read_word(dev);
+        if(y < 0) {
+            return;
+        }
+        event->type = type;
+        event->x = x;
+        event->y = y;
     }
 }
 
+/**
+  * Blocks until the screen is touched, with no timeout. If the panel does not
+  * answer the following status query within dev->timeout, the link is
+  * resynced and the event type is ULCD_NO_ACTIVITY.
+  */
 void ulcd_wait_event(ulcd_dev *dev, ulcd_event *event) {
-    // Get coords
+    // Get coords. The panel only answers once touched.
     write_char(dev, 0x6F);
     write_char(dev, 0x00);
-    event->x = read_word(dev);
-    event->y = read_word(dev);
+    event->x = read_word_timeout(dev, 0);
+    event->y = read_word_timeout(dev, 0);
 
     // Get type
     write_char(dev, 0x6F);
     write_char(dev, 0x04);
-    event->type = read_word(dev);
-    read_word(dev);
+    int type = read_word(dev);
+    if(type < 0 || read_word(dev) < 0) {
+        type = ULCD_NO_ACTIVITY;
+    }
+    event->type = type;
 }
 
 // Draw stuff
 
-int ulcd_blit(ulcd_dev *dev,
-              uint16_t x, uint16_t y,
-              uint16_t w, uint16_t h,
-              const char* data) {
-
-    char buf[10];
-
+/**
+  * Fills the 10 byte header of a 16 bit blit (0x49). The w*h*2 bytes of
+  * big-endian pixel data follow it on the wire.
+  */
+void ulcd_encode_blit(char *buf, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
     buf[0] = 0x49;
     buf[1] = x >> 8;
     buf[2] = x & 0xFF;
@@ -220,16 +400,147 @@ int ulcd_blit(ulcd_dev *dev,
     buf[7] = h >> 8;
     buf[8] = h & 0xFF;
     buf[9] = 0x10;
+}
 
-    serial_write(dev->port, buf, 10);
-    serial_write(dev->port, data, w*h*2);
+void ulcd_row_merge_init(ulcd_row_merge *m, int merge_bytes) {
+    m->merge_bytes = merge_bytes;
+    m->active = 0;
+}
 
-    if(!check_result(dev, "Error while blitting.")) {
+/**
+  * Adds a damaged row. Rows must be added in increasing order.
+  * @param lo First changed column
+  * @param hi Last changed column
+  * @param out Receives a finished rectangle
+  * @return 1 if out was filled and should be sent, 0 otherwise.
+  */
+int ulcd_row_merge_add(ulcd_row_merge *m, int y, int lo, int hi, ulcd_rect *out) {
+    ulcd_rect *r = &m->cur;
+    if(m->active) {
+        int gap = y - r->y1 - 1;
+        int nx0 = (lo < r->x0) ? lo : r->x0;
+        int nx1 = (hi > r->x1) ? hi : r->x1;
+        if((long long)gap * (nx1 - nx0 + 1) * 2 < m->merge_bytes) {
+            r->y1 = y;
+            r->x0 = nx0;
+            r->x1 = nx1;
+            return 0;
+        }
+        *out = *r;
+    }
+    r->x0 = lo;
+    r->y0 = r->y1 = y;
+    r->x1 = hi;
+    int done = m->active;
+    m->active = 1;
+    return done;
+}
+
+/**
+  * Ends the rows.
+  * @param out Receives the last rectangle
+  * @return 1 if out was filled and should be sent, 0 if no rows were added.
+  */
+int ulcd_row_merge_finish(ulcd_row_merge *m, ulcd_rect *out) {
+    if(!m->active) {
         return 0;
     }
+    *out = m->cur;
+    m->active = 0;
     return 1;
 }
 
+int ulcd_blit(ulcd_dev *dev,
+              uint16_t x, uint16_t y,
+              uint16_t w, uint16_t h,
+              const char* data) {
+
+    char buf[10];
+    ulcd_encode_blit(buf, x, y, w, h);
+    return send_checked(dev, buf, 10, data, w*h*2, "Error while blitting.");
+}
+
+// Sends a blit whose rows are scattered in memory. Rows are written straight
+// from the source with writev, or through a small bounce buffer when they
+// need to be byte-swapped. Rows wider than the bounce buffer are split
+// across writes.
+static void write_blit_rows(ulcd_dev *dev, const char *head,
+                            const char *src, int stride,
+                            uint16_t w, uint16_t h, int swap) {
+    serial_chunk chunks[65];
+    int row = 0, n, i;
+    int row_len = w * 2;
+
+    if(!swap) {
+        chunks[0].data = head;
+        chunks[0].len = 10;
+        n = 1;
+        do {
+            while(row < h && n < 65) {
+                chunks[n].data = src + row * stride;
+                chunks[n].len = row_len;
+                n++;
+                row++;
+            }
+            serial_writev(dev->port, chunks, n);
+            n = 0;
+        } while(row < h);
+        return;
+    }
+
+    char bounce[4096];
+    int pos = 0;
+    serial_write(dev->port, head, 10);
+    for(row = 0; row < h; row++) {
+        const char *in = src + row * stride;
+        for(i = 0; i < row_len; i += 2) {
+            if(pos == (int)sizeof(bounce)) {
+                serial_write(dev->port, bounce, pos);
+                pos = 0;
+            }
+            bounce[pos] = in[i + 1];
+            bounce[pos + 1] = in[i];
+            pos += 2;
+        }
+    }
+    if(pos > 0) {
+        serial_write(dev->port, bounce, pos);
+    }
+}
+
+/**
+  * Blits a sub-rectangle of a larger framebuffer without copying it first.
+  * @param x,y Position on the panel
+  * @param base Start of the source framebuffer, RGB565 pixels
+  * @param stride Bytes between the starts of two source rows
+  * @param sx,sy,w,h Rectangle to send from the source
+  * @param flags ULCD_BLIT_SWAP if source pixels are little-endian (native on x86)
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_blit_rect(ulcd_dev *dev,
+                   uint16_t x, uint16_t y,
+                   const char *base, int stride,
+                   uint16_t sx, uint16_t sy,
+                   uint16_t w, uint16_t h,
+                   int flags) {
+    char buf[10];
+    if(w == 0 || h == 0) {
+        return 1;
+    }
+
+    ulcd_encode_blit(buf, x, y, w, h);
+
+    const char *src = base + sy * stride + sx * 2;
+    int attempt;
+    for(attempt = 0; attempt <= dev->retries; attempt++) {
+        write_blit_rows(dev, buf, src, stride, w, h, flags & ULCD_BLIT_SWAP);
+        if(check_result(dev, "Error while blitting.")) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int ulcd_draw_line(ulcd_dev *dev,
                    uint16_t x0, uint16_t y0,
                    uint16_t x1, uint16_t y1,
@@ -249,11 +560,7 @@ int ulcd_draw_line(ulcd_dev *dev,
     buf[9] = color >> 8;
     buf[10] = color & 0xFF;
 
-    serial_write(dev->port, buf, 11);
-    if(!check_result(dev, "Error while drawing line.")) {
-        return 0;
-    }
-    return 1;
+    return send_checked(dev, buf, 11, 0, 0, "Error while drawing line.");
 }
 
 int ulcd_draw_rect(ulcd_dev *dev,
@@ -275,11 +582,7 @@ int ulcd_draw_rect(ulcd_dev *dev,
     buf[9] = color >> 8;
     buf[10] = color & 0xFF;
 
-    serial_write(dev->port, buf, 11);
-    if(!check_result(dev, "Error while drawing rectangle.")) {
-        return 0;
-    }
-    return 1;
+    return send_checked(dev, buf, 11, 0, 0, "Error while drawing rectangle.");
 }
 
 int ulcd_draw_circle(ulcd_dev *dev,
@@ -296,11 +599,7 @@ int ulcd_draw_circle(ulcd_dev *dev,
     buf[6] = radius & 0xFF;
     buf[7] = color >> 8;
     buf[8] = color & 0xFF;
-    serial_write(dev->port, buf, 9);
-    if(!check_result(dev, "Error while drawing circle.")) {
-        return 0;
-    }
-    return 1;
+    return send_checked(dev, buf, 9, 0, 0, "Error while drawing circle.");
 }
 
 int ulcd_pen_style(ulcd_dev *dev, int style) {
@@ -309,13 +608,130 @@ int ulcd_pen_style(ulcd_dev *dev, int style) {
     buf[0] = 0x70;
     buf[1] = style;
 
-    serial_write(dev->port, buf, 2);
-    if(!check_result(dev, "Pen style change failed.")) {
+    // Remember the style, so optimising layers can skip redundant changes.
+    if(!send_checked(dev, buf, 2, 0, 0, "Pen style change failed.")) {
+        dev->pen = -1;
         return 0;
     }
+    dev->pen = style;
     return 1;
 }
 
+// Fills the command buffer for a single colour replacement. Buffer must be 13 bytes.
+static void encode_replace_color(char *buf,
+                                 uint16_t x0, uint16_t y0,
+                                 uint16_t x1, uint16_t y1,
+                                 uint16_t from, uint16_t to) {
+    buf[0] = 0x6B;
+    buf[1] = x0 >> 8;
+    buf[2] = x0 & 0xFF;
+    buf[3] = y0 >> 8;
+    buf[4] = y0 & 0xFF;
+    buf[5] = x1 >> 8;
+    buf[6] = x1 & 0xFF;
+    buf[7] = y1 >> 8;
+    buf[8] = y1 & 0xFF;
+    buf[9] = from >> 8;
+    buf[10] = from & 0xFF;
+    buf[11] = to >> 8;
+    buf[12] = to & 0xFF;
+}
+
+/**
+  * Replaces one colour with another inside a region. Done entirely on the panel.
+  * Colours are RGB565 values, eg. from alloc_color().
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_replace_color(ulcd_dev *dev,
+                       uint16_t x0, uint16_t y0,
+                       uint16_t x1, uint16_t y1,
+                       uint16_t from, uint16_t to) {
+    char buf[13];
+    encode_replace_color(buf, x0, y0, x1, y1, from, to);
+    return send_checked(dev, buf, 13, 0, 0, "Error while replacing color.");
+}
+
+static int rule_uses(const ulcd_color_map *rules, int count, uint16_t c) {
+    int i;
+    for(i = 0; i < count; i++) {
+        if(rules[i].from == c || rules[i].to == c) return 1;
+    }
+    return 0;
+}
+
+/**
+  * Applies a set of colour replacement rules to a region as one mapping: a
+  * pixel is changed by at most one rule. Rules are sent one at a time,
+  * ordered so that no rule's result is picked up by a later rule.
+  * @param scratch Colour to break cycles through (A->B, B->A), or -1 to fail
+  *        on cycles. Pixels of this colour in the region are changed along
+  *        with the cycle, so pass a colour that isn't used there.
+  * @return 1 on success, 0 on failure. Nothing is sent if the rules can't
+  *         be applied.
+  */
+int ulcd_replace_colors(ulcd_dev *dev,
+                        uint16_t x0, uint16_t y0,
+                        uint16_t x1, uint16_t y1,
+                        const ulcd_color_map *maps, int count,
+                        int scratch) {
+    if(count <= 0) {
+        return 1;
+    }
+
+    // Pending rules, followed by room for the commands to send. Each cycle
+    // costs one extra command.
+    ulcd_color_map *rules = (ulcd_color_map*)malloc(count * 3 * sizeof(ulcd_color_map));
+    if(!rules) {
+        sprintf(errorstr, "Out of memory.");
+        return 0;
+    }
+    ulcd_color_map *steps = rules + count;
+
+    // Identity rules and repeated sources are dropped, the first rule for a
+    // colour wins.
+    int n = 0, nsteps = 0, i, j;
+    for(i = 0; i < count; i++) {
+        if(maps[i].from == maps[i].to) continue;
+        for(j = 0; j < n && rules[j].from != maps[i].from; j++);
+        if(j == n) rules[n++] = maps[i];
+    }
+    if(scratch >= 0 && (scratch > 0xFFFF || rule_uses(rules, n, scratch))) {
+        sprintf(errorstr, "Scratch colour is used by a rule.");
+        free(rules);
+        return 0;
+    }
+
+    while(n > 0) {
+        // Take a rule whose result is not the source of another pending rule.
+        for(i = 0; i < n; i++) {
+            for(j = 0; j < n && rules[j].from != rules[i].to; j++);
+            if(j == n) break;
+        }
+
+        if(i < n) {
+            steps[nsteps++] = rules[i];
+            rules[i] = rules[--n];
+        } else if(scratch >= 0) {
+            // Every rule is in a cycle. Park one source in the scratch colour,
+            // which turns the cycle into a chain.
+            steps[nsteps].from = rules[0].from;
+            steps[nsteps++].to = scratch;
+            rules[0].from = scratch;
+        } else {
+            sprintf(errorstr, "Colour rules form a cycle.");
+            free(rules);
+            return 0;
+        }
+    }
+
+    int ok = 1;
+    for(i = 0; i < nsteps && ok; i++) {
+        ok = ulcd_replace_color(dev, x0, y0, x1, y1, steps[i].from, steps[i].to);
+    }
+    free(rules);
+    return ok;
+}
+
 int ulcd_draw_pixel(ulcd_dev *dev,
                     uint16_t x, uint16_t y,
                     uint16_t color) {
@@ -327,11 +743,7 @@ int ulcd_draw_pixel(ulcd_dev *dev,
     buf[4] = y & 0xFF;
     buf[5] = color >> 8;
     buf[6] = color & 0xFF;
-    serial_write(dev->port, buf, 7);
-    if(!check_result(dev, "Error while drawing pixel.")) {
-        return 0;
-    }
-    return 1;
+    return send_checked(dev, buf, 7, 0, 0, "Error while drawing pixel.");
 }
 
 int ulcd_draw_ellipse(ulcd_dev *dev,
@@ -350,11 +762,7 @@ int ulcd_draw_ellipse(ulcd_dev *dev,
     buf[8] = yrad & 0xFF;
     buf[9] = color >> 8;
     buf[10] = color & 0xFF;
-    serial_write(dev->port, buf, 11);
-    if(!check_result(dev, "Error while drawing pixel.")) {
-        return 0;
-    }
-    return 1;
+    return send_checked(dev, buf, 11, 0, 0, "Error while drawing pixel.");
 }
 
 int ulcd_draw_text(ulcd_dev *dev,
@@ -379,27 +787,56 @@ int ulcd_draw_text(ulcd_dev *dev,
     buf[8] = 0x01;
     buf[9] = 0x01;
 
-    // Send data
-    serial_write(dev->port, buf, 10);
-    serial_write(dev->port, text, textlen);
-    write_char(dev, 0x00);
+    // Send data, including the terminating null
+    return send_checked(dev, buf, 10, text, textlen + 1, "Text drawing failed.");
+}
 
-    // Check results
-    if(!check_result(dev, "Text drawing failed.")) {
+/**
+  * Size of the panel's built-in fonts (0-3) as drawn by ulcd_draw_text().
+  * @param advance Receives the distance between characters, including spacing
+  * @param height Receives the character height
+  * @return 1 on success, 0 if the font number is invalid.
+  */
+int ulcd_text_metrics(int font, int *advance, int *height) {
+    static const int size[4][2] = {{5, 7}, {8, 8}, {8, 12}, {12, 16}};
+    if(font < 0 || font > 3) {
         return 0;
     }
+    *advance = size[font][0] + 1;
+    *height = size[font][1];
     return 1;
 }
 
-uint16_t ulcd_read_pixel(ulcd_dev *dev, uint16_t x, uint16_t y) {
+/**
+  * Reads the colour of a pixel. If the panel does not answer within
+  * dev->timeout, the link is resynced and 0 is returned.
+  * @param color Receives the RGB565 colour
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_get_pixel(ulcd_dev *dev, uint16_t x, uint16_t y, uint16_t *color) {
     char buf[5];
     buf[0] = 0x52;
     buf[1] = x >> 8;
     buf[2] = x & 0xFF;
     buf[3] = y >> 8;
     buf[4] = y & 0xFF;
-    serial_write(dev->port, buf, 11);
-    return read_word(dev);
+    serial_write(dev->port, buf, 5);
+    int word = read_word(dev);
+    if(word < 0) {
+        return 0;
+    }
+    *color = word;
+    return 1;
+}
+
+/**
+  * Reads the colour of a pixel. Returns 0xFFFF on timeout, which can't be
+  * told apart from white; use ulcd_get_pixel() to detect failures.
+  */
+uint16_t ulcd_read_pixel(ulcd_dev *dev, uint16_t x, uint16_t y) {
+    uint16_t color = 0xFFFF;
+    ulcd_get_pixel(dev, x, y, &color);
+    return color;
 }
 
 // Audio
@@ -480,7 +917,13 @@ int ulcd_sd_list(ulcd_dev *dev, const char *filter, char *buffer, int buflen) {
             break;
         }
 
-        in = read_char(dev);
+        int c = read_char(dev);
+        if(c < 0) {
+            sprintf(errorstr, "Directory listing timed out.");
+            ulcd_resync(dev);
+            return pos;
+        }
+        in = c;
         if(in == 0x06 && last == 0) {
             return pos;
         }
@@ -531,7 +974,7 @@ int ulcd_sd_image_save(ulcd_dev *dev, const char *file, uint16_t x, uint16_t y,
     // Commands
     char buf[10];
     buf[0] = 0x40;
-    buf[1] = 0x64;
+    buf[1] = 0x63;
     buf[2] = x >> 8;
     buf[3] = x & 0xFF;
     buf[4] = y >> 8;
@@ -0,0 +1,534 @@
+#include "ulcd_engine.h"
+#include "serial.h"
+
+#ifdef LINUX
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#endif
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+#ifdef LINUX
+
+#define ENGINE_MAX_REPLY 64
+#define ENGINE_MAX_EVENTS 32
+#define ENGINE_DEFAULT_TIMEOUT 1000
+#define ENGINE_QUIET_MS 20        // Silence that ends a drain
+#define ENGINE_RESYNC_TIMEOUT 100
+#define ENGINE_RESYNC_TRIES 4
+
+// Resync states. After a timeout or a garbled reply the link is drained
+// until quiet, the autobaud byte is sent until the panel ACKs it, and the
+// link is drained once more before queued commands are written again.
+enum {
+    LINK_OK = 0,
+    LINK_DRAIN,
+    LINK_AUTOBAUD,
+    LINK_SETTLE,
+};
+
+typedef struct engine_cmd {
+    char *data;
+    int len;
+    int reply_len;
+    int got;
+    char reply[ENGINE_MAX_REPLY];
+    long deadline;       // When the reply is due, set once the command is written
+    ulcd_engine_cb cb;
+    void *userdata;
+    struct engine_cmd *next;
+} engine_cmd;
+
+typedef struct engine_link {
+    ulcd_dev *dev;
+    engine_cmd *head;    // Oldest command still waiting for a reply
+    engine_cmd *unsent;  // First command not yet fully written
+    engine_cmd *tail;
+    int written;         // Bytes of unsent already written
+    int inflight;
+    int count;
+    int want_out;
+    int removed;
+    int state;           // LINK_OK or a resync step
+    int tries;           // Autobaud bytes sent in this resync
+    long wake;           // When the current resync step ends
+    struct engine_link *next_dead;
+} engine_link;
+
+struct ulcd_engine {
+    int epfd;
+    int depth;
+    engine_link **links;
+    int nlinks;
+    int busy;            // Inside run or submit, links can't be freed yet
+    engine_link *dead;   // Links removed while busy
+};
+
+static long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// Frees links removed from inside a callback once nothing uses them.
+static void release_dead(ulcd_engine *eng) {
+    if(eng->busy) {
+        return;
+    }
+    while(eng->dead) {
+        engine_link *link = eng->dead;
+        eng->dead = link->next_dead;
+        free(link);
+    }
+}
+
+// Drops a link whose fd failed. Its commands complete with ok = 0.
+static void fail_link(ulcd_engine *eng, engine_link *link, const char *why) {
+    sprintf(errorstr, "Engine link failed: %s", why);
+    ulcd_engine_remove(eng, link->dev);
+}
+
+static engine_link* find_link(ulcd_engine *eng, ulcd_dev *dev) {
+    int i;
+    for(i = 0; i < eng->nlinks; i++) {
+        if(eng->links[i]->dev == dev) {
+            return eng->links[i];
+        }
+    }
+    return 0;
+}
+
+static void update_interest(ulcd_engine *eng, engine_link *link) {
+    if(link->removed) {
+        return;
+    }
+    int want = (link->unsent != 0 &&
+                (link->state == LINK_OK ? link->inflight < eng->depth : link->written > 0));
+    if(want == link->want_out) {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.ptr = link;
+    epoll_ctl(eng->epfd, EPOLL_CTL_MOD, link->dev->port->handle, &ev);
+    link->want_out = want;
+}
+
+static void complete_head(engine_link *link, int ok) {
+    engine_cmd *cmd = link->head;
+    link->head = cmd->next;
+    if(link->tail == cmd) {
+        link->tail = 0;
+    }
+    link->inflight--;
+    link->count--;
+    if(cmd->cb) {
+        cmd->cb(link->dev, ok, cmd->reply, cmd->got, cmd->userdata);
+    }
+    free(cmd->data);
+    free(cmd);
+}
+
+// Completes sent commands at the head of the queue that expect no reply.
+static void drain_no_reply(engine_link *link) {
+    while(link->head && link->head != link->unsent && link->head->reply_len == 0) {
+        complete_head(link, 1);
+    }
+}
+
+// Fails everything in flight and starts resyncing the link. Replies still
+// on their way can't be told apart from those of later commands.
+static void start_resync(engine_link *link, long now) {
+    link->state = LINK_DRAIN;
+    link->tries = 0;
+    link->wake = now + ENGINE_QUIET_MS;
+    while(!link->removed && link->head && link->head != link->unsent) {
+        complete_head(link, 0);
+    }
+}
+
+// Writes as many queued commands as the pipeline depth and the fd allow.
+// While resyncing only a partly written command is finished, so the panel
+// is not left waiting for the rest of it.
+static void flush_link(ulcd_engine *eng, engine_link *link) {
+    while(link->unsent && (link->state == LINK_OK ? link->inflight < eng->depth : link->written > 0)) {
+        engine_cmd *cmd = link->unsent;
+        int left = cmd->len - link->written;
+        int w = write(link->dev->port->handle, cmd->data + link->written, left);
+        if(w < 0) {
+            if(errno != EAGAIN && errno != EINTR) {
+                fail_link(eng, link, strerror(errno));
+            }
+            break;
+        }
+        link->written += w;
+        if(link->written < cmd->len) {
+            break;
+        }
+        link->unsent = cmd->next;
+        link->written = 0;
+        link->inflight++;
+        cmd->deadline = now_ms() + (link->dev->timeout > 0 ? link->dev->timeout : ENGINE_DEFAULT_TIMEOUT);
+        if(link->state != LINK_OK) {
+            // Its reply will be drained
+            complete_head(link, cmd->reply_len == 0);
+            if(link->removed) break;
+            continue;
+        }
+        drain_no_reply(link);
+    }
+    update_interest(eng, link);
+}
+
+// Advances a resync with bytes that arrived from the panel.
+static void feed_resync(engine_link *link, const char *buf, int len) {
+    int i;
+    for(i = 0; i < len; i++) {
+        if(link->state == LINK_AUTOBAUD && (unsigned char)buf[i] == 0x06) {
+            link->state = LINK_SETTLE;
+            link->wake = now_ms() + ENGINE_QUIET_MS;
+        } else if(link->state != LINK_AUTOBAUD) {
+            link->wake = now_ms() + ENGINE_QUIET_MS;
+        }
+    }
+}
+
+// Moves a resync on once its current step is over.
+static void step_resync(ulcd_engine *eng, engine_link *link, long now) {
+    if(link->state == LINK_OK || now < link->wake) {
+        return;
+    }
+    switch(link->state) {
+        case LINK_DRAIN:
+            if(link->written > 0) {
+                // The rest of a command is still being written
+                return;
+            }
+            if(link->tries == ENGINE_RESYNC_TRIES) {
+                fail_link(eng, link, "could not resynchronize");
+                return;
+            }
+            char c = 0x55;
+            if(write(link->dev->port->handle, &c, 1) == 1) {
+                link->state = LINK_AUTOBAUD;
+                link->tries++;
+                link->wake = now + ENGINE_RESYNC_TIMEOUT;
+            } else {
+                link->wake = now + 1;
+            }
+            break;
+        case LINK_AUTOBAUD:
+            link->state = LINK_DRAIN;
+            link->wake = now + ENGINE_QUIET_MS;
+            break;
+        case LINK_SETTLE:
+            // The panel may have reset, so its pen style is unknown.
+            link->dev->pen = -1;
+            link->state = LINK_OK;
+            break;
+    }
+}
+
+// Advances reply parsing with bytes that arrived from the panel.
+static void feed_link(engine_link *link, const char *buf, int len) {
+    int i = 0;
+    while(i < len && !link->removed) {
+        if(link->state != LINK_OK) {
+            feed_resync(link, buf + i, len - i);
+            return;
+        }
+        engine_cmd *cmd = link->head;
+        if(cmd == 0 || cmd == link->unsent) {
+            // Nothing in flight, so this byte is noise. Drop it.
+            i++;
+            continue;
+        }
+        if(cmd->got == 0 && cmd->reply_len > 1 && (unsigned char)buf[i] == 0x15) {
+            // NAK instead of a reply
+            i++;
+            complete_head(link, 0);
+            drain_no_reply(link);
+            continue;
+        }
+        int take = cmd->reply_len - cmd->got;
+        if(take > len - i) {
+            take = len - i;
+        }
+        memcpy(cmd->reply + cmd->got, buf + i, take);
+        cmd->got += take;
+        i += take;
+        if(cmd->got == cmd->reply_len) {
+            int ok = 1;
+            if(cmd->reply_len == 1 && (unsigned char)cmd->reply[0] != 0x06) {
+                ok = 0;
+            }
+            if(cmd->reply_len == 1 && (unsigned char)cmd->reply[0] != 0x15 && !ok) {
+                // Neither ACK nor NAK, so later replies may be off too
+                sprintf(errorstr, "Engine got an unexpected reply.");
+                start_resync(link, now_ms());
+                continue;
+            }
+            complete_head(link, ok);
+            drain_no_reply(link);
+        }
+    }
+}
+
+ulcd_engine* ulcd_engine_create() {
+    int fd = epoll_create1(0);
+    if(fd < 0) {
+        sprintf(errorstr, "Could not create epoll instance.");
+        return 0;
+    }
+    ulcd_engine *eng = (ulcd_engine*)malloc(sizeof(ulcd_engine));
+    eng->epfd = fd;
+    eng->depth = 1;
+    eng->links = 0;
+    eng->nlinks = 0;
+    eng->busy = 0;
+    eng->dead = 0;
+    return eng;
+}
+
+void ulcd_engine_free(ulcd_engine *eng) {
+    if(eng == 0) return;
+    while(eng->nlinks > 0) {
+        ulcd_engine_remove(eng, eng->links[0]->dev);
+    }
+    free(eng->links);
+    close(eng->epfd);
+    free(eng);
+}
+
+/**
+  * Registers a device with the engine. The device must not be used through
+  * the blocking API while it is registered.
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_engine_add(ulcd_engine *eng, ulcd_dev *dev) {
+    if(find_link(eng, dev)) {
+        return 1;
+    }
+    engine_link *link = (engine_link*)malloc(sizeof(engine_link));
+    memset(link, 0, sizeof(engine_link));
+    link->dev = dev;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = link;
+    if(epoll_ctl(eng->epfd, EPOLL_CTL_ADD, dev->port->handle, &ev) != 0) {
+        sprintf(errorstr, "Could not register device: %s", strerror(errno));
+        free(link);
+        return 0;
+    }
+
+    eng->links = (engine_link**)realloc(eng->links, sizeof(engine_link*) * (eng->nlinks + 1));
+    eng->links[eng->nlinks++] = link;
+    return 1;
+}
+
+/**
+  * Unregisters a device. Queued commands are dropped and their callbacks
+  * are called with ok = 0. May be called from a callback.
+  */
+int ulcd_engine_remove(ulcd_engine *eng, ulcd_dev *dev) {
+    int i;
+    for(i = 0; i < eng->nlinks; i++) {
+        if(eng->links[i]->dev == dev) {
+            break;
+        }
+    }
+    if(i == eng->nlinks) {
+        return 0;
+    }
+    engine_link *link = eng->links[i];
+    eng->links[i] = eng->links[--eng->nlinks];
+
+    epoll_ctl(eng->epfd, EPOLL_CTL_DEL, dev->port->handle, 0);
+    link->removed = 1;
+    link->unsent = 0;
+    eng->busy++;
+    while(link->head) {
+        link->inflight++; // complete_head() accounts for this
+        complete_head(link, 0);
+    }
+    eng->busy--;
+
+    // The caller may be inside this link's callbacks, free it afterwards.
+    link->next_dead = eng->dead;
+    eng->dead = link;
+    release_dead(eng);
+    return 1;
+}
+
+/**
+  * Sets how many commands may be in flight per device before waiting for
+  * replies. Default is 1.
+  */
+int ulcd_engine_set_pipeline(ulcd_engine *eng, int depth) {
+    if(depth < 1) {
+        return 0;
+    }
+    eng->depth = depth;
+    return 1;
+}
+
+/**
+  * Queues a command for a device. The command bytes are copied.
+  * @param reply_len Reply bytes to wait for. 1 means an ACK/NAK reply,
+  *        0 means the command completes once written.
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_engine_submit(ulcd_engine *eng, ulcd_dev *dev,
+                       const char *cmd, int len, int reply_len,
+                       ulcd_engine_cb cb, void *userdata) {
+    engine_link *link = find_link(eng, dev);
+    if(link == 0) {
+        sprintf(errorstr, "Device not registered with engine.");
+        return 0;
+    }
+    if(reply_len < 0 || reply_len > ENGINE_MAX_REPLY || len <= 0) {
+        sprintf(errorstr, "Invalid command.");
+        return 0;
+    }
+
+    engine_cmd *c = (engine_cmd*)malloc(sizeof(engine_cmd));
+    c->data = (char*)malloc(len);
+    memcpy(c->data, cmd, len);
+    c->len = len;
+    c->reply_len = reply_len;
+    c->got = 0;
+    c->cb = cb;
+    c->userdata = userdata;
+    c->next = 0;
+
+    if(link->tail) {
+        link->tail->next = c;
+    } else {
+        link->head = c;
+    }
+    link->tail = c;
+    if(link->unsent == 0) {
+        link->unsent = c;
+    }
+    link->count++;
+
+    eng->busy++;
+    flush_link(eng, link);
+    int ok = !link->removed;
+    eng->busy--;
+    release_dead(eng);
+    return ok;
+}
+
+/**
+  * @return Number of queued or in-flight commands for a device.
+  */
+int ulcd_engine_pending(ulcd_engine *eng, ulcd_dev *dev) {
+    engine_link *link = find_link(eng, dev);
+    return link ? link->count : 0;
+}
+
+// Fails in-flight commands once a reply is overdue, and moves resyncs on.
+static void expire_link(ulcd_engine *eng, engine_link *link, long now) {
+    if(link->state == LINK_OK && link->head && link->head != link->unsent && link->head->deadline <= now) {
+        sprintf(errorstr, "Engine command timed out.");
+        start_resync(link, now);
+    }
+    if(!link->removed) {
+        step_resync(eng, link, now);
+    }
+    if(!link->removed) {
+        flush_link(eng, link);
+    }
+}
+
+/**
+  * Waits for I/O on all devices and advances their state. Commands that get
+  * no reply within the device timeout complete with ok = 0 and the link is
+  * resynced. Devices whose port fails or hangs up, or that don't resync,
+  * are removed.
+  * @param timeout_ms Max time to wait, -1 for forever.
+  * @return Number of devices serviced, -1 on error.
+  */
+int ulcd_engine_run(ulcd_engine *eng, int timeout_ms) {
+    struct epoll_event evs[ENGINE_MAX_EVENTS];
+    char buf[256];
+    int i;
+
+    // Wake up for the earliest reply deadline or resync step
+    long now = now_ms();
+    for(i = 0; i < eng->nlinks; i++) {
+        engine_link *link = eng->links[i];
+        long when = -1;
+        if(link->state != LINK_OK) {
+            when = link->wake;
+        } else if(link->head && link->head != link->unsent) {
+            when = link->head->deadline;
+        }
+        if(when >= 0) {
+            long left = when - now;
+            if(left < 0) left = 0;
+            if(timeout_ms < 0 || left < timeout_ms) timeout_ms = left;
+        }
+    }
+
+    int n = epoll_wait(eng->epfd, evs, ENGINE_MAX_EVENTS, timeout_ms);
+    if(n < 0) {
+        if(errno == EINTR) {
+            return 0;
+        }
+        sprintf(errorstr, "Engine wait failed: %s", strerror(errno));
+        return -1;
+    }
+
+    eng->busy++;
+    for(i = 0; i < n; i++) {
+        engine_link *link = (engine_link*)evs[i].data.ptr;
+        if(link->removed) {
+            continue;
+        }
+        if(evs[i].events & EPOLLIN) {
+            int got, total = 0;
+            while((got = read(link->dev->port->handle, buf, sizeof(buf))) > 0) {
+                total += got;
+                feed_link(link, buf, got);
+                if(link->removed) break;
+            }
+            if(link->removed) {
+                continue;
+            }
+            // A tty with VMIN = 0 also reads 0 bytes when empty, so only a
+            // wakeup with nothing to read at all means end of file.
+            if(got == 0 && total == 0) {
+                fail_link(eng, link, "port closed");
+                continue;
+            }
+            if(got < 0 && errno != EAGAIN && errno != EINTR) {
+                fail_link(eng, link, strerror(errno));
+                continue;
+            }
+        }
+        if(evs[i].events & (EPOLLHUP | EPOLLERR)) {
+            fail_link(eng, link, "port hung up");
+            continue;
+        }
+        flush_link(eng, link);
+    }
+
+    now = now_ms();
+    for(i = 0; i < eng->nlinks; i++) {
+        expire_link(eng, eng->links[i], now);
+    }
+    eng->busy--;
+    release_dead(eng);
+    return n;
+}
+
+#endif // LINUX
@@ -0,0 +1,556 @@
+// For memfd_create
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "ulcd_fb.h"
+#include "ulcd_touch.h"
+
+#ifdef LINUX
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+#ifdef LINUX
+
+// Damaged rows closer than this many bytes of blit data are sent as one
+// rectangle, see ulcd_row_merge. Damage from several clients is patchier
+// than a stream's, so this errs towards fewer blits. Used until a cost
+// model is set.
+#define FB_MERGE_BYTES 512
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define FB_BLIT_FLAGS ULCD_BLIT_SWAP
+#else
+#define FB_BLIT_FLAGS 0
+#endif
+
+struct ulcd_fb_server {
+    ulcd_dev *dev;
+    char path[108];
+    int listen_fd;
+    int w, h;
+    uint16_t *pixels;
+    size_t size;
+    int memfd;
+    int clients[ULCD_FB_MAX_CLIENTS];
+    int sync_seq[ULCD_FB_MAX_CLIENTS];  // Sequence to answer after the next push, -1 if none
+    int *lo, *hi;                       // Damaged span of each row, lo is -1 when clean
+    int dirty;
+    int merge_bytes;
+    ulcd_touch_poller touch;
+    ulcd_fb_stats stats;
+};
+
+// The server sends with MSG_DONTWAIT so a stuck client can't stall the
+// panel. Clients block instead, their damage must not be lost.
+static int send_msg(int fd, int flags, int type, int x, int y, int w, int h, int value) {
+    ulcd_fb_msg m;
+    m.type = type;
+    m.x = x;
+    m.y = y;
+    m.w = w;
+    m.h = h;
+    m.value = value;
+    return send(fd, &m, sizeof(m), MSG_NOSIGNAL | flags) == sizeof(m);
+}
+
+// Server
+
+/**
+  * Creates a framebuffer server for a panel and starts listening on path.
+  * The panel is cleared to match the initially black framebuffer.
+  * @param path Socket path, eg. ULCD_FB_SOCKET. A stale socket left there is
+  *        replaced, anything else at the path is an error.
+  * @return Server, or 0 on failure.
+  */
+ulcd_fb_server* ulcd_fb_server_create(ulcd_dev *dev, const char *path) {
+    if(dev->w <= 0 || dev->h <= 0) {
+        sprintf(errorstr, "Unknown screen size.");
+        return 0;
+    }
+    if(strlen(path) >= sizeof(((struct sockaddr_un*)0)->sun_path)) {
+        sprintf(errorstr, "Socket path too long.");
+        return 0;
+    }
+
+    ulcd_fb_server *s = (ulcd_fb_server*)calloc(1, sizeof(ulcd_fb_server));
+    int i;
+    s->dev = dev;
+    s->w = dev->w;
+    s->h = dev->h;
+    s->listen_fd = -1;
+    s->memfd = -1;
+    s->merge_bytes = FB_MERGE_BYTES;
+    strcpy(s->path, path);
+    for(i = 0; i < ULCD_FB_MAX_CLIENTS; i++) {
+        s->clients[i] = -1;
+        s->sync_seq[i] = -1;
+    }
+    s->lo = (int*)malloc(s->h * sizeof(int));
+    s->hi = (int*)malloc(s->h * sizeof(int));
+    for(i = 0; i < s->h; i++) {
+        s->lo[i] = -1;
+    }
+
+    // Framebuffer
+    s->size = (size_t)s->w * s->h * 2;
+    s->memfd = memfd_create("ulcd-fb", MFD_CLOEXEC);
+    if(s->memfd < 0 || ftruncate(s->memfd, s->size) != 0) {
+        sprintf(errorstr, "Could not create framebuffer: %s", strerror(errno));
+        ulcd_fb_server_free(s);
+        return 0;
+    }
+    s->pixels = (uint16_t*)mmap(0, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, s->memfd, 0);
+    if(s->pixels == MAP_FAILED) {
+        s->pixels = 0;
+        sprintf(errorstr, "Could not map framebuffer: %s", strerror(errno));
+        ulcd_fb_server_free(s);
+        return 0;
+    }
+
+    // Socket
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    struct stat st;
+    if(lstat(path, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            sprintf(errorstr, "%s exists and is not a socket.", path);
+            ulcd_fb_server_free(s);
+            return 0;
+        }
+        // Only a stale socket is replaced, not a running server
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        int live = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        if(probe >= 0) close(probe);
+        if(live) {
+            sprintf(errorstr, "A framebuffer server is already running on %s.", path);
+            ulcd_fb_server_free(s);
+            return 0;
+        }
+        unlink(path);
+    }
+    s->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(s->listen_fd < 0 || bind(s->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        sprintf(errorstr, "Could not listen on %s: %s", path, strerror(errno));
+        // Nothing of ours at path to remove
+        if(s->listen_fd >= 0) close(s->listen_fd);
+        s->listen_fd = -1;
+        ulcd_fb_server_free(s);
+        return 0;
+    }
+    if(listen(s->listen_fd, 8) != 0) {
+        sprintf(errorstr, "Could not listen on %s: %s", path, strerror(errno));
+        ulcd_fb_server_free(s);
+        return 0;
+    }
+
+    if(!ulcd_clear(dev)) {
+        ulcd_fb_server_free(s);
+        return 0;
+    }
+    ulcd_touch_init(&s->touch, dev, 10, 100);
+    return s;
+}
+
+void ulcd_fb_server_free(ulcd_fb_server *s) {
+    if(s == 0) return;
+    int i;
+    for(i = 0; i < ULCD_FB_MAX_CLIENTS; i++) {
+        if(s->clients[i] >= 0) close(s->clients[i]);
+    }
+    if(s->listen_fd >= 0) {
+        close(s->listen_fd);
+        unlink(s->path);
+    }
+    if(s->pixels) munmap(s->pixels, s->size);
+    if(s->memfd >= 0) close(s->memfd);
+    free(s->lo);
+    free(s->hi);
+    free(s);
+}
+
+static void drop_client(ulcd_fb_server *s, int i) {
+    close(s->clients[i]);
+    s->clients[i] = -1;
+    s->sync_seq[i] = -1;
+}
+
+static void accept_clients(ulcd_fb_server *s) {
+    int fd;
+    while((fd = accept4(s->listen_fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int i;
+        for(i = 0; i < ULCD_FB_MAX_CLIENTS && s->clients[i] >= 0; i++);
+        if(i == ULCD_FB_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+
+        // Hello, with the framebuffer fd attached
+        ulcd_fb_msg m;
+        memset(&m, 0, sizeof(m));
+        m.type = ULCD_FB_HELLO;
+        m.w = s->w;
+        m.h = s->h;
+        m.value = s->w * 2;
+
+        char ctrl[CMSG_SPACE(sizeof(int))];
+        struct iovec iov = { &m, sizeof(m) };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        memset(ctrl, 0, sizeof(ctrl));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &s->memfd, sizeof(int));
+
+        if(sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(m)) {
+            close(fd);
+            continue;
+        }
+        s->clients[i] = fd;
+        s->sync_seq[i] = -1;
+    }
+}
+
+static void add_damage(ulcd_fb_server *s, int x, int y, int w, int h) {
+    int x1 = x + w - 1, y1 = y + h - 1;
+    if(x < 0) x = 0;
+    if(y < 0) y = 0;
+    if(x1 >= s->w) x1 = s->w - 1;
+    if(y1 >= s->h) y1 = s->h - 1;
+    if(w <= 0 || h <= 0 || x > x1 || y > y1) {
+        return;
+    }
+    for(; y <= y1; y++) {
+        if(s->lo[y] < 0) {
+            s->lo[y] = x;
+            s->hi[y] = x1;
+        } else {
+            if(x < s->lo[y]) s->lo[y] = x;
+            if(x1 > s->hi[y]) s->hi[y] = x1;
+        }
+    }
+    s->dirty = 1;
+}
+
+static void read_client(ulcd_fb_server *s, int i) {
+    ulcd_fb_msg m;
+    int n;
+    while((n = recv(s->clients[i], &m, sizeof(m), MSG_DONTWAIT)) == sizeof(m)) {
+        if(m.type == ULCD_FB_DAMAGE) {
+            s->stats.damage_msgs++;
+            add_damage(s, m.x, m.y, m.w, m.h);
+        } else if(m.type == ULCD_FB_SYNC) {
+            s->sync_seq[i] = m.value;
+        }
+    }
+    if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        drop_client(s, i);
+    }
+}
+
+static void blit(ulcd_fb_server *s, int x0, int y0, int x1, int y1) {
+    int w = x1 - x0 + 1, h = y1 - y0 + 1;
+    if(!ulcd_blit_rect(s->dev, x0, y0, (const char*)s->pixels, s->w * 2,
+                       x0, y0, w, h, FB_BLIT_FLAGS)) {
+        s->stats.errors++;
+    }
+    s->stats.blits++;
+    s->stats.pixels += w * h;
+}
+
+// Sends the damaged rows as rectangles and marks everything clean.
+static void push_damage(ulcd_fb_server *s) {
+    int y;
+    ulcd_row_merge m;
+    ulcd_rect r;
+    ulcd_row_merge_init(&m, s->merge_bytes);
+    for(y = 0; y < s->h; y++) {
+        int lo = s->lo[y];
+        if(lo < 0) {
+            continue;
+        }
+        s->lo[y] = -1;
+        if(ulcd_row_merge_add(&m, y, lo, s->hi[y], &r)) {
+            blit(s, r.x0, r.y0, r.x1, r.y1);
+        }
+    }
+    if(ulcd_row_merge_finish(&m, &r)) {
+        blit(s, r.x0, r.y0, r.x1, r.y1);
+    }
+    s->dirty = 0;
+    s->stats.pushes++;
+}
+
+/**
+  * Runs one iteration of the server: accepts clients, reads their damage,
+  * pushes it to the panel and polls the touch screen. Call it in a loop.
+  * @param timeout_ms Longest time to wait for clients
+  * @return 1 on success, 0 if the server can't continue.
+  */
+int ulcd_fb_server_run(ulcd_fb_server *s, int timeout_ms) {
+    struct pollfd fds[ULCD_FB_MAX_CLIENTS + 1];
+    int idx[ULCD_FB_MAX_CLIENTS + 1];
+    int n = 0, i;
+
+    fds[n].fd = s->listen_fd;
+    fds[n].events = POLLIN;
+    idx[n++] = -1;
+    for(i = 0; i < ULCD_FB_MAX_CLIENTS; i++) {
+        if(s->clients[i] >= 0) {
+            fds[n].fd = s->clients[i];
+            fds[n].events = POLLIN;
+            idx[n++] = i;
+        }
+    }
+
+    int wait = ulcd_touch_next_poll_ms(&s->touch);
+    if(wait > timeout_ms) wait = timeout_ms;
+    if(poll(fds, n, wait) < 0) {
+        if(errno == EINTR) return 1;
+        sprintf(errorstr, "Poll failed: %s", strerror(errno));
+        return 0;
+    }
+
+    for(i = 0; i < n; i++) {
+        if(!fds[i].revents) continue;
+        if(idx[i] < 0) {
+            accept_clients(s);
+        } else {
+            read_client(s, idx[i]);
+        }
+    }
+
+    if(s->dirty) {
+        push_damage(s);
+    }
+    for(i = 0; i < ULCD_FB_MAX_CLIENTS; i++) {
+        if(s->clients[i] >= 0 && s->sync_seq[i] >= 0) {
+            send_msg(s->clients[i], MSG_DONTWAIT, ULCD_FB_SYNC, 0, 0, 0, 0, s->sync_seq[i]);
+            s->sync_seq[i] = -1;
+        }
+    }
+
+    ulcd_event ev;
+    ulcd_touch_poll(&s->touch);
+    while(ulcd_touch_get(&s->touch, &ev)) {
+        for(i = 0; i < ULCD_FB_MAX_CLIENTS; i++) {
+            if(s->clients[i] >= 0) {
+                send_msg(s->clients[i], MSG_DONTWAIT, ULCD_FB_TOUCH, ev.x, ev.y, 0, 0, ev.type);
+            }
+        }
+    }
+    return 1;
+}
+
+void ulcd_fb_server_get_stats(ulcd_fb_server *s, ulcd_fb_stats *stats) {
+    *stats = s->stats;
+}
+
+/**
+  * Sizes the merging of damaged rows for the panel's link, see
+  * ulcd_cost_merge_bytes.
+  * @param model Cost model, or 0 for the built-in default
+  */
+void ulcd_fb_server_set_cost_model(ulcd_fb_server *s, const ulcd_cost_model *model) {
+    int merge = model ? ulcd_cost_merge_bytes(model) : 0;
+    s->merge_bytes = merge > 0 ? merge : FB_MERGE_BYTES;
+}
+
+// Client
+
+/**
+  * Connects to a framebuffer server and maps its framebuffer.
+  * @param path Socket path, eg. ULCD_FB_SOCKET
+  * @return Client, or 0 on failure.
+  */
+ulcd_fb_client* ulcd_fb_connect(const char *path) {
+    struct sockaddr_un addr;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        sprintf(errorstr, "Socket path too long.");
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        sprintf(errorstr, "Could not connect to %s: %s", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return 0;
+    }
+
+    ulcd_fb_msg m;
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &m, sizeof(m) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    int memfd = -1;
+    if(recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) == sizeof(m) && m.type == ULCD_FB_HELLO) {
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        if(cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            memcpy(&memfd, CMSG_DATA(cm), sizeof(int));
+        }
+    }
+    if(memfd < 0) {
+        sprintf(errorstr, "Bad hello from framebuffer server.");
+        close(fd);
+        return 0;
+    }
+
+    ulcd_fb_client *c = (ulcd_fb_client*)calloc(1, sizeof(ulcd_fb_client));
+    c->fd = fd;
+    c->w = m.w;
+    c->h = m.h;
+    c->stride = m.value;
+    c->size = (size_t)c->stride * c->h;
+    c->pixels = (uint16_t*)mmap(0, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    close(memfd);
+    if(c->pixels == MAP_FAILED) {
+        sprintf(errorstr, "Could not map framebuffer: %s", strerror(errno));
+        close(fd);
+        free(c);
+        return 0;
+    }
+    return c;
+}
+
+void ulcd_fb_disconnect(ulcd_fb_client *c) {
+    if(c == 0) return;
+    munmap(c->pixels, c->size);
+    close(c->fd);
+    free(c);
+}
+
+/**
+  * Tells the server a rectangle of the framebuffer has changed. Blocks while
+  * the server is behind.
+  * @return 1 on success, 0 if the server is gone.
+  */
+int ulcd_fb_damage(ulcd_fb_client *c, int x, int y, int w, int h) {
+    if(!send_msg(c->fd, 0, ULCD_FB_DAMAGE, x, y, w, h, 0)) {
+        sprintf(errorstr, "Could not send damage: %s", strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+static void queue_event(ulcd_fb_client *c, const ulcd_fb_msg *m) {
+    if(c->count == ULCD_FB_QUEUE) {
+        // Full, drop the oldest
+        c->head = (c->head + 1) % ULCD_FB_QUEUE;
+        c->count--;
+    }
+    ulcd_event *ev = &c->queue[(c->head + c->count) % ULCD_FB_QUEUE];
+    ev->x = m->x;
+    ev->y = m->y;
+    ev->type = m->value;
+    c->count++;
+}
+
+// Reads one message, queueing touch events. Returns the message type, 0 if
+// nothing arrived in time or -1 if the server is gone.
+static int read_server(ulcd_fb_client *c, int timeout_ms, ulcd_fb_msg *m) {
+    struct pollfd p;
+    p.fd = c->fd;
+    p.events = POLLIN;
+    if(poll(&p, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+    int n = recv(c->fd, m, sizeof(ulcd_fb_msg), MSG_DONTWAIT);
+    if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        sprintf(errorstr, "Framebuffer server closed the connection.");
+        return -1;
+    }
+    if(n != sizeof(ulcd_fb_msg)) {
+        return 0;
+    }
+    if(m->type == ULCD_FB_TOUCH) {
+        queue_event(c, m);
+    }
+    return m->type;
+}
+
+/**
+  * Waits until all damage sent so far is on the panel.
+  * @return 1 on success, 0 on timeout or if the server is gone.
+  */
+int ulcd_fb_sync(ulcd_fb_client *c, int timeout_ms) {
+    ulcd_fb_msg m;
+    c->seq = (c->seq + 1) & 0x7FFFFFFF;
+    if(!send_msg(c->fd, 0, ULCD_FB_SYNC, 0, 0, 0, 0, c->seq)) {
+        sprintf(errorstr, "Could not send sync: %s", strerror(errno));
+        return 0;
+    }
+    for(;;) {
+        int type = read_server(c, timeout_ms, &m);
+        if(type < 0) return 0;
+        if(type == 0) {
+            sprintf(errorstr, "Timeout while waiting for sync.");
+            return 0;
+        }
+        if(type == ULCD_FB_SYNC && m.value == c->seq) {
+            return 1;
+        }
+    }
+}
+
+/**
+  * Takes the oldest touch event without blocking.
+  * @return 1 if an event was returned, 0 otherwise.
+  */
+int ulcd_fb_get_event(ulcd_fb_client *c, ulcd_event *event) {
+    ulcd_fb_msg m;
+    while(read_server(c, 0, &m) > 0);
+    if(c->count == 0) {
+        return 0;
+    }
+    *event = c->queue[c->head];
+    c->head = (c->head + 1) % ULCD_FB_QUEUE;
+    c->count--;
+    return 1;
+}
+
+/**
+  * Waits up to timeout_ms for a touch event, -1 to wait forever.
+  * @return 1 if an event was returned, 0 otherwise.
+  */
+int ulcd_fb_wait_event(ulcd_fb_client *c, ulcd_event *event, int timeout_ms) {
+    ulcd_fb_msg m;
+    if(ulcd_fb_get_event(c, event)) {
+        return 1;
+    }
+    while(read_server(c, timeout_ms, &m) > 0) {
+        if(m.type == ULCD_FB_TOUCH) {
+            return ulcd_fb_get_event(c, event);
+        }
+    }
+    return 0;
+}
+
+#endif // LINUX
@@ -0,0 +1,330 @@
+#include "ulcd_font.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+// Largest glyph size, offset or advance and font ascent or descent, in
+// pixels. Far more than any panel shows, and small enough that no cell
+// size overflows an int.
+#define FONT_MAX_SIZE 1024
+
+// BDF loading
+
+static int in_range(int v, int lo, int hi) {
+    return v >= lo && v <= hi;
+}
+
+static int hex_value(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 0;
+}
+
+/**
+  * Loads a BDF bitmap font. Only glyphs with encodings 0-255 are kept.
+  * @return Font, or 0 on failure.
+  */
+ulcd_font* ulcd_font_load_bdf(const char *file) {
+    FILE *f = fopen(file, "r");
+    if(!f) {
+        sprintf(errorstr, "Could not open font file.");
+        return 0;
+    }
+
+    ulcd_font *font = (ulcd_font*)calloc(1, sizeof(ulcd_font));
+    if(!font) {
+        sprintf(errorstr, "Out of memory.");
+        fclose(f);
+        return 0;
+    }
+    char line[512];
+    int code = -1, dwidth = 0;
+    int bw = 0, bh = 0, bx = 0, by = 0;
+    int row = -1;
+    ulcd_glyph *g = 0;
+
+    while(fgets(line, sizeof(line), f)) {
+        if(row >= 0) {
+            if(strncmp(line, "ENDCHAR", 7) == 0) {
+                row = -1;
+                g = 0;
+                continue;
+            }
+            if(g && row < g->h) {
+                int bytes = (g->w + 7) / 8, i;
+                for(i = 0; i < bytes && line[i*2] && line[i*2 + 1]; i++) {
+                    g->bits[row * bytes + i] = (hex_value(line[i*2]) << 4) | hex_value(line[i*2 + 1]);
+                }
+            }
+            row++;
+            continue;
+        }
+
+        if(strncmp(line, "FONT_ASCENT ", 12) == 0) {
+            font->ascent = atoi(line + 12);
+        } else if(strncmp(line, "FONT_DESCENT ", 13) == 0) {
+            font->descent = atoi(line + 13);
+        } else if(strncmp(line, "STARTCHAR", 9) == 0) {
+            code = -1;
+            dwidth = 0;
+            bw = bh = bx = by = 0;
+        } else if(strncmp(line, "ENCODING ", 9) == 0) {
+            code = atoi(line + 9);
+        } else if(strncmp(line, "DWIDTH ", 7) == 0) {
+            dwidth = atoi(line + 7);
+        } else if(strncmp(line, "BBX ", 4) == 0) {
+            sscanf(line + 4, "%d %d %d %d", &bw, &bh, &bx, &by);
+        } else if(strncmp(line, "BITMAP", 6) == 0) {
+            row = 0;
+            if(code < 0 || code >= 256) {
+                continue;
+            }
+            if(!in_range(bw, 0, FONT_MAX_SIZE) || !in_range(bh, 0, FONT_MAX_SIZE)
+               || !in_range(bx, -FONT_MAX_SIZE, FONT_MAX_SIZE) || !in_range(by, -FONT_MAX_SIZE, FONT_MAX_SIZE)
+               || !in_range(dwidth, 0, FONT_MAX_SIZE)) {
+                sprintf(errorstr, "Glyph %d size out of range.", code);
+                fclose(f);
+                ulcd_font_free(font);
+                return 0;
+            }
+            g = &font->glyphs[code];
+            free(g->bits);
+            g->w = bw;
+            g->h = bh;
+            g->xoff = bx;
+            g->yoff = by;
+            g->advance = dwidth ? dwidth : bw;
+            g->bits = (unsigned char*)calloc(1, ((bw + 7) / 8) * bh + 1);
+            if(!g->bits) {
+                sprintf(errorstr, "Out of memory.");
+                fclose(f);
+                ulcd_font_free(font);
+                return 0;
+            }
+        }
+    }
+    fclose(f);
+
+    if(!in_range(font->ascent, -FONT_MAX_SIZE, FONT_MAX_SIZE) || !in_range(font->descent, -FONT_MAX_SIZE, FONT_MAX_SIZE)) {
+        sprintf(errorstr, "Font metrics out of range.");
+        ulcd_font_free(font);
+        return 0;
+    }
+
+    if(font->ascent + font->descent <= 0) {
+        // No global metrics, derive them from the glyphs.
+        int i;
+        for(i = 0; i < 256; i++) {
+            ulcd_glyph *gl = &font->glyphs[i];
+            if(!gl->bits) continue;
+            if(gl->yoff + gl->h > font->ascent) font->ascent = gl->yoff + gl->h;
+            if(-gl->yoff > font->descent) font->descent = -gl->yoff;
+        }
+    }
+    if(font->ascent + font->descent <= 0) {
+        sprintf(errorstr, "Font has no glyphs.");
+        ulcd_font_free(font);
+        return 0;
+    }
+    return font;
+}
+
+void ulcd_font_free(ulcd_font *font) {
+    if(font == 0) return;
+    int i;
+    for(i = 0; i < 256; i++) {
+        free(font->glyphs[i].bits);
+    }
+    free(font->kerning);
+    free(font);
+}
+
+/**
+  * Sets the spacing adjustment between two characters, in pixels.
+  * Atlas glyphs are drawn with their background, so negative kerning makes
+  * a glyph's background cover the edge of the previous glyph.
+  */
+void ulcd_font_set_kerning(ulcd_font *font, unsigned char left, unsigned char right, int adjust) {
+    if(!font->kerning) {
+        font->kerning = (signed char*)calloc(256 * 256, 1);
+    }
+    font->kerning[left * 256 + right] = adjust;
+}
+
+static int kern(ulcd_font *font, unsigned char left, unsigned char right) {
+    return font->kerning ? font->kerning[left * 256 + right] : 0;
+}
+
+/**
+  * @return Width of a string in pixels, including kerning.
+  */
+int ulcd_font_text_width(ulcd_font *font, const char *text) {
+    const unsigned char *s = (const unsigned char*)text;
+    int w = 0;
+    for(; *s; s++) {
+        if(!font->glyphs[*s].bits) continue;
+        w += font->glyphs[*s].advance;
+        if(s[1]) {
+            w += kern(font, s[0], s[1]);
+        }
+    }
+    return w;
+}
+
+// Atlases
+
+static int has_cell(ulcd_font_atlas *a, unsigned char c) {
+    return a->font->glyphs[c].bits && a->font->glyphs[c].advance > 0 && a->height > 0;
+}
+
+// Rasterises a glyph into an advance x height cell with the atlas colours.
+// @return The cell, or 0 if the glyph has none or memory ran out.
+static char* atlas_cell(ulcd_font_atlas *a, unsigned char c) {
+    if(a->cells[c]) {
+        return a->cells[c];
+    }
+    ulcd_glyph *g = &a->font->glyphs[c];
+    int cw = g->advance, ch = a->height;
+    if(!has_cell(a, c)) {
+        return 0;
+    }
+
+    char *cell = (char*)malloc(cw * ch * 2);
+    if(!cell) {
+        sprintf(errorstr, "Out of memory.");
+        return 0;
+    }
+    int bytes = (g->w + 7) / 8;
+    int top = a->font->ascent - (g->yoff + g->h);
+    int x, y;
+    for(y = 0; y < ch; y++) {
+        for(x = 0; x < cw; x++) {
+            int gx = x - g->xoff, gy = y - top;
+            int on = 0;
+            if(gx >= 0 && gx < g->w && gy >= 0 && gy < g->h) {
+                on = (g->bits[gy * bytes + gx / 8] >> (7 - gx % 8)) & 1;
+            }
+            uint16_t px = on ? a->fg : a->bg;
+            cell[(y * cw + x) * 2] = px >> 8;
+            cell[(y * cw + x) * 2 + 1] = px & 0xFF;
+        }
+    }
+    a->cells[c] = cell;
+    return cell;
+}
+
+static void glyph_file(char *name, int id, unsigned char c) {
+    sprintf(name, "G%02X%02X.IMG", id & 0xFF, c);
+}
+
+/**
+  * Creates an atlas for drawing a font in one colour pair.
+  * @param id Atlas number 0-255, used in the SD card file names
+  */
+ulcd_font_atlas* ulcd_font_atlas_create(ulcd_dev *dev, ulcd_font *font, int id, uint16_t fg, uint16_t bg) {
+    ulcd_font_atlas *a = (ulcd_font_atlas*)calloc(1, sizeof(ulcd_font_atlas));
+    if(!a) {
+        sprintf(errorstr, "Out of memory.");
+        return 0;
+    }
+    a->dev = dev;
+    a->font = font;
+    a->id = id;
+    a->fg = fg;
+    a->bg = bg;
+    a->height = font->ascent + font->descent;
+    return a;
+}
+
+void ulcd_font_atlas_free(ulcd_font_atlas *a) {
+    if(a == 0) return;
+    int i;
+    for(i = 0; i < 256; i++) {
+        free(a->cells[i]);
+    }
+    free(a);
+}
+
+/**
+  * Stores glyphs on the SD card. Each glyph is blitted to a scratch area of
+  * the screen and saved from there, so the scratch area is overwritten.
+  * @param chars Characters to upload, or 0 for every glyph in the font
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_font_atlas_upload(ulcd_font_atlas *a, const char *chars, uint16_t scratch_x, uint16_t scratch_y) {
+    char name[16];
+    int c;
+    for(c = 1; c < 256; c++) {
+        if(chars && !strchr(chars, c)) continue;
+        if(!has_cell(a, c) || a->uploaded[c]) continue;
+        char *cell = atlas_cell(a, c);
+        if(!cell) {
+            return 0;
+        }
+
+        int cw = a->font->glyphs[c].advance;
+        glyph_file(name, a->id, c);
+        if(!ulcd_blit(a->dev, scratch_x, scratch_y, cw, a->height, cell)) {
+            return 0;
+        }
+        if(!ulcd_sd_image_save(a->dev, name, scratch_x, scratch_y, cw, a->height)) {
+            return 0;
+        }
+        a->uploaded[c] = 1;
+    }
+    return 1;
+}
+
+/**
+  * Marks glyphs as already stored on the SD card, eg. by an earlier run
+  * with the same atlas id and colours.
+  * @param chars Characters to mark, or 0 for every glyph in the font
+  */
+void ulcd_font_atlas_attach(ulcd_font_atlas *a, const char *chars) {
+    int c;
+    for(c = 1; c < 256; c++) {
+        if(chars && !strchr(chars, c)) continue;
+        if(a->font->glyphs[c].bits) {
+            a->uploaded[c] = 1;
+        }
+    }
+}
+
+/**
+  * Draws a string with its top left corner at x, y. Uploaded glyphs are
+  * loaded from the SD card, others are blitted from the host cache.
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_font_draw(ulcd_font_atlas *a, const char *text, int x, int y) {
+    const unsigned char *s = (const unsigned char*)text;
+    char name[16];
+    int ok = 1;
+    for(; *s; s++) {
+        ulcd_glyph *g = &a->font->glyphs[*s];
+        if(!has_cell(a, *s)) continue;
+        char *cell = atlas_cell(a, *s);
+        if(!cell) {
+            ok = 0;
+            continue;
+        }
+
+        if(x >= 0 && y >= 0 && x + g->advance <= a->dev->w && y + a->height <= a->dev->h) {
+            if(a->uploaded[*s]) {
+                glyph_file(name, a->id, *s);
+                ok &= ulcd_sd_image_load(a->dev, name, x, y);
+            } else {
+                ok &= ulcd_blit(a->dev, x, y, g->advance, a->height, cell);
+            }
+        }
+        x += g->advance;
+        if(s[1]) {
+            x += kern(a->font, s[0], s[1]);
+        }
+    }
+    return ok;
+}
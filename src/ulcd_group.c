@@ -0,0 +1,298 @@
+#include "ulcd_group.h"
+#include "serial.h"
+
+#ifdef LINUX
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/uio.h>
+#endif
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+#ifdef LINUX
+
+// Assumed when the port can't tell its speed
+#define GROUP_DEFAULT_BAUD 115200
+
+typedef struct group_member {
+    ulcd_dev *dev;
+    int baud;
+    int status;
+    int off;
+    int done;
+    int owed;    // Bytes of an interrupted command the panel still waits for
+    int stale;   // Out of sync until recovered
+} group_member;
+
+struct ulcd_group {
+    group_member *members;
+    struct pollfd *fds;
+    int count;
+    int timeout;
+};
+
+static long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Time to send bytes to a member at its line speed, with 25% slack.
+static long transfer_ms(group_member *m, int bytes) {
+    return (long)((long long)bytes * 10 * 1000 * 5 / 4 / m->baud);
+}
+
+// Completes a command the member was left in the middle of with zero
+// bytes, so the panel is back at a command boundary. Also waits until the
+// link takes more data, as the resync that follows blocks on a full link.
+static int finish_member(group_member *m, long deadline) {
+    static const char zeros[256];
+    for(;;) {
+        long wait = deadline - now_ms();
+        if(wait <= 0) {
+            return 0;
+        }
+        struct pollfd pfd;
+        pfd.fd = m->dev->port->handle;
+        pfd.events = POLLOUT;
+        if(poll(&pfd, 1, (int)wait) <= 0 || !(pfd.revents & POLLOUT)) {
+            continue;
+        }
+        if(m->owed == 0) {
+            return 1;
+        }
+        int w = write(m->dev->port->handle, zeros, m->owed < (int)sizeof(zeros) ? m->owed : (int)sizeof(zeros));
+        if(w < 0) {
+            if(errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        m->owed -= w;
+    }
+}
+
+// Gets a member that timed out back in sync. Any late reply is drained by
+// the resync. Members that can't be recovered are skipped until a later
+// command recovers them.
+static void recover_member(ulcd_group *g, group_member *m) {
+    long deadline = now_ms() + g->timeout + transfer_ms(m, m->owed);
+    m->stale = !(finish_member(m, deadline) && ulcd_resync(m->dev));
+}
+
+// Writes the next piece of header+body to a member without blocking.
+static int write_member(group_member *m, const char *head, int head_len, const char *body, int body_len) {
+    struct iovec iov[2];
+    int n = 0;
+    if(m->off < head_len) {
+        iov[n].iov_base = (void*)(head + m->off);
+        iov[n].iov_len = head_len - m->off;
+        n++;
+        if(body_len > 0) {
+            iov[n].iov_base = (void*)body;
+            iov[n].iov_len = body_len;
+            n++;
+        }
+    } else {
+        iov[n].iov_base = (void*)(body + (m->off - head_len));
+        iov[n].iov_len = body_len - (m->off - head_len);
+        n++;
+    }
+    int w = writev(m->dev->port->handle, iov, n);
+    if(w < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    m->off += w;
+    return w;
+}
+
+// Sends header+body to every member and collects ACKs. Returns the number of
+// members that ACKed.
+static int group_transfer(ulcd_group *g, const char *head, int head_len, const char *body, int body_len) {
+    int total = head_len + body_len;
+    int i, left = g->count;
+
+    for(i = 0; i < g->count; i++) {
+        group_member *m = &g->members[i];
+        if(m->stale) {
+            recover_member(g, m);
+        }
+        m->off = 0;
+        m->done = m->stale;
+        m->status = ULCD_GROUP_TIMEOUT;
+        if(m->done) {
+            left--;
+        }
+    }
+
+    // Slowest link first
+    long slowest = 0;
+    for(i = 0; i < g->count; i++) {
+        long ms = transfer_ms(&g->members[i], total);
+        if(ms > slowest) slowest = ms;
+    }
+    long deadline = now_ms() + g->timeout + slowest;
+
+    while(left > 0) {
+        long wait = deadline - now_ms();
+        if(wait <= 0) {
+            break;
+        }
+
+        int n = 0;
+        for(i = 0; i < g->count; i++) {
+            group_member *m = &g->members[i];
+            if(m->done) {
+                continue;
+            }
+            g->fds[n].fd = m->dev->port->handle;
+            g->fds[n].events = (m->off < total) ? POLLOUT : POLLIN;
+            g->fds[n].revents = 0;
+            n++;
+        }
+        if(poll(g->fds, n, (int)wait) < 0 && errno != EINTR) {
+            sprintf(errorstr, "Group poll failed: %s", strerror(errno));
+            break;
+        }
+
+        n = 0;
+        for(i = 0; i < g->count; i++) {
+            group_member *m = &g->members[i];
+            if(m->done) {
+                continue;
+            }
+            short rev = g->fds[n++].revents;
+            if(rev & (POLLERR|POLLHUP|POLLNVAL)) {
+                m->status = ULCD_GROUP_IO_ERROR;
+                m->done = 1;
+                left--;
+                continue;
+            }
+            if((rev & POLLOUT) && m->off < total) {
+                if(write_member(m, head, head_len, body, body_len) < 0) {
+                    m->status = ULCD_GROUP_IO_ERROR;
+                    m->done = 1;
+                    left--;
+                }
+                continue;
+            }
+            if(rev & POLLIN) {
+                unsigned char c;
+                if(read(m->dev->port->handle, &c, 1) == 1) {
+                    m->status = (c == 0x06) ? ULCD_GROUP_OK : ULCD_GROUP_NAK;
+                    m->done = 1;
+                    left--;
+                }
+            }
+        }
+    }
+
+    int ok = 0;
+    for(i = 0; i < g->count; i++) {
+        group_member *m = &g->members[i];
+        if(m->status == ULCD_GROUP_OK) {
+            ok++;
+        } else if(m->status == ULCD_GROUP_TIMEOUT && !m->done) {
+            m->owed = total - m->off;
+            recover_member(g, m);
+        }
+    }
+    if(ok < g->count) {
+        sprintf(errorstr, "%d of %d panels failed.", g->count - ok, g->count);
+    }
+    return ok;
+}
+
+/**
+  * Creates a group of already initialized devices. The devices are not owned
+  * by the group.
+  */
+ulcd_group* ulcd_group_create(ulcd_dev **devs, int count) {
+    if(count <= 0) {
+        sprintf(errorstr, "Empty device group.");
+        return 0;
+    }
+    ulcd_group *g = (ulcd_group*)malloc(sizeof(ulcd_group));
+    g->members = (group_member*)malloc(sizeof(group_member) * count);
+    g->fds = (struct pollfd*)malloc(sizeof(struct pollfd) * count);
+    g->count = count;
+    g->timeout = 1000;
+
+    int i;
+    for(i = 0; i < count; i++) {
+        g->members[i].dev = devs[i];
+        g->members[i].baud = serial_get_baud(devs[i]->port);
+        if(g->members[i].baud <= 0) {
+            g->members[i].baud = GROUP_DEFAULT_BAUD;
+        }
+        g->members[i].status = ULCD_GROUP_OK;
+        g->members[i].off = 0;
+        g->members[i].done = 0;
+        g->members[i].owed = 0;
+        g->members[i].stale = 0;
+    }
+    return g;
+}
+
+void ulcd_group_free(ulcd_group *group) {
+    if(group == 0) return;
+    free(group->members);
+    free(group->fds);
+    free(group);
+}
+
+/**
+  * Sets the base time to wait for ACKs. Large transfers get extra time for
+  * their size at the slowest member's line speed.
+  */
+void ulcd_group_set_timeout(ulcd_group *group, int timeout_ms) {
+    group->timeout = timeout_ms;
+}
+
+int ulcd_group_size(ulcd_group *group) {
+    return group->count;
+}
+
+/**
+  * @return Result of the last command for a member, see GROUP_STATUS.
+  */
+int ulcd_group_status(ulcd_group *group, int index) {
+    if(index < 0 || index >= group->count) {
+        return ULCD_GROUP_IO_ERROR;
+    }
+    return group->members[index].status;
+}
+
+/**
+  * Sends a pre-encoded command to every member.
+  * @return Number of members that ACKed.
+  */
+int ulcd_group_send(ulcd_group *group, const char *cmd, int len) {
+    return group_transfer(group, cmd, len, 0, 0);
+}
+
+int ulcd_group_clear(ulcd_group *group) {
+    char c = 0x45;
+    return group_transfer(group, &c, 1, 0, 0);
+}
+
+/**
+  * Blits the same image to every member. The pixel data is shared, not copied.
+  * @return Number of members that ACKed.
+  */
+int ulcd_group_blit(ulcd_group *group,
+                    uint16_t x, uint16_t y,
+                    uint16_t w, uint16_t h,
+                    const char* data) {
+    char buf[10];
+    ulcd_encode_blit(buf, x, y, w, h);
+    return group_transfer(group, buf, 10, data, w*h*2);
+}
+
+#endif // LINUX
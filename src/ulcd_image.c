@@ -0,0 +1,598 @@
+#include "ulcd_image.h"
+
+#include <limits.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+// Decoded source image, 8 bits per channel RGB.
+typedef struct {
+    int w, h;
+    unsigned char *rgb;
+} rgb_image;
+
+typedef struct cache_entry {
+    uint64_t hash;
+    int w, h, flags;
+    ulcd_image *img;
+    struct cache_entry *prev, *next;
+} cache_entry;
+
+static cache_entry *cache_head = 0;
+static cache_entry *cache_tail = 0;
+static int cache_count = 0;
+static int cache_max = 16;
+static char cache_dir[256] = {0};
+
+// Hashing
+
+static uint64_t hash_data(const char *data, int len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+    for(i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Sizes are validated so that w * h * channels and all indexing into the
+// buffer fit in an int.
+static int size_ok(int w, int h, int channels) {
+    return w > 0 && h > 0 && (long long)w * h * channels <= INT_MAX;
+}
+
+// Decoders
+
+static int get_le16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+static int get_le32(const unsigned char *p) { return (int)(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24)); }
+
+// A BI_BITFIELDS colour mask, shifted down to bit 0.
+typedef struct {
+    unsigned mask;
+    int shift;
+} bmp_mask;
+
+static void read_mask(const unsigned char *p, bmp_mask *m) {
+    m->mask = (unsigned)get_le32(p);
+    m->shift = 0;
+    while(m->mask && !(m->mask & 1)) {
+        m->mask >>= 1;
+        m->shift++;
+    }
+}
+
+// Scales the masked bits of a pixel to 0..255. An empty mask reads as 0.
+static unsigned char mask_channel(unsigned px, const bmp_mask *m) {
+    if(m->mask == 0) {
+        return 0;
+    }
+    return (unsigned char)((unsigned long long)((px >> m->shift) & m->mask) * 255 / m->mask);
+}
+
+static int decode_bmp(const unsigned char *src, int len, rgb_image *out) {
+    if(len < 54) {
+        sprintf(errorstr, "BMP file truncated.");
+        return 0;
+    }
+    int offset = get_le32(src + 10);
+    int w = get_le32(src + 18);
+    int h = get_le32(src + 22);
+    int bpp = get_le16(src + 28);
+    int compression = get_le32(src + 30);
+    int flip = 1;
+    if(h == INT_MIN) {
+        sprintf(errorstr, "Image too large.");
+        return 0;
+    }
+    if(h < 0) {
+        h = -h;
+        flip = 0;
+    }
+    // BI_RGB at 24 or 32 bits, BI_BITFIELDS at 16 or 32 bits
+    int rgb = (compression == 0 && (bpp == 24 || bpp == 32));
+    int fields = (compression == 3 && (bpp == 16 || bpp == 32));
+    if(w <= 0 || h <= 0 || (!rgb && !fields) || (fields && get_le32(src + 14) < 40)) {
+        sprintf(errorstr, "Unsupported BMP format.");
+        return 0;
+    }
+    // The red, green and blue masks follow the 40 byte info header, or are
+    // part of the newer headers at the same place.
+    bmp_mask masks[3];
+    if(fields) {
+        if(len < 66) {
+            sprintf(errorstr, "BMP file truncated.");
+            return 0;
+        }
+        read_mask(src + 54, &masks[0]);
+        read_mask(src + 58, &masks[1]);
+        read_mask(src + 62, &masks[2]);
+    }
+    int bytes = bpp / 8;
+    if(w > (INT_MAX - 3) / bytes || !size_ok(w, h, 3)) {
+        sprintf(errorstr, "Image too large.");
+        return 0;
+    }
+    size_t stride = ((size_t)w * bytes + 3) & ~(size_t)3;
+    if(offset < 0 || (size_t)offset + stride * h > (size_t)len) {
+        sprintf(errorstr, "BMP file truncated.");
+        return 0;
+    }
+
+    out->w = w;
+    out->h = h;
+    out->rgb = (unsigned char*)malloc((size_t)w * h * 3);
+    if(!out->rgb) {
+        sprintf(errorstr, "Out of memory.");
+        return 0;
+    }
+    int x, y;
+    for(y = 0; y < h; y++) {
+        const unsigned char *row = src + offset + (size_t)(flip ? (h - 1 - y) : y) * stride;
+        unsigned char *dst = out->rgb + y * w * 3;
+        if(fields) {
+            for(x = 0; x < w; x++) {
+                unsigned p = (bytes == 4) ? (unsigned)get_le32(row + x*4) : (unsigned)get_le16(row + x*2);
+                dst[x*3 + 0] = mask_channel(p, &masks[0]);
+                dst[x*3 + 1] = mask_channel(p, &masks[1]);
+                dst[x*3 + 2] = mask_channel(p, &masks[2]);
+            }
+            continue;
+        }
+        for(x = 0; x < w; x++) {
+            dst[x*3 + 0] = row[x*bytes + 2];
+            dst[x*3 + 1] = row[x*bytes + 1];
+            dst[x*3 + 2] = row[x*bytes + 0];
+        }
+    }
+    return 1;
+}
+
+// Reads the next whitespace separated number from a PPM header, skipping
+// comments. Numbers too large for an int are read as INT_MAX.
+static int ppm_number(const unsigned char *src, int len, int *pos) {
+    int v = 0, digits = 0;
+    while(*pos < len) {
+        unsigned char c = src[*pos];
+        if(c == '#') {
+            while(*pos < len && src[*pos] != '\n') (*pos)++;
+        } else if(c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            (*pos)++;
+        } else {
+            break;
+        }
+    }
+    while(*pos < len && src[*pos] >= '0' && src[*pos] <= '9') {
+        int d = src[*pos] - '0';
+        v = (v > (INT_MAX - d) / 10) ? INT_MAX : v * 10 + d;
+        (*pos)++;
+        digits++;
+    }
+    return digits ? v : -1;
+}
+
+static int decode_ppm(const unsigned char *src, int len, rgb_image *out) {
+    int pos = 2;
+    int w = ppm_number(src, len, &pos);
+    int h = ppm_number(src, len, &pos);
+    int maxval = ppm_number(src, len, &pos);
+    pos++; // Single whitespace before pixel data
+    if(w <= 0 || h <= 0 || maxval <= 0 || maxval > 65535) {
+        sprintf(errorstr, "Invalid PPM header.");
+        return 0;
+    }
+    int bytes = (maxval > 255) ? 2 : 1;
+    if(!size_ok(w, h, 3 * bytes)) {
+        sprintf(errorstr, "Image too large.");
+        return 0;
+    }
+    if(pos + (size_t)w * h * 3 * bytes > (size_t)len) {
+        sprintf(errorstr, "PPM file truncated.");
+        return 0;
+    }
+
+    out->w = w;
+    out->h = h;
+    out->rgb = (unsigned char*)malloc((size_t)w * h * 3);
+    if(!out->rgb) {
+        sprintf(errorstr, "Out of memory.");
+        return 0;
+    }
+    int i;
+    for(i = 0; i < w * h * 3; i++) {
+        int v = (bytes == 2) ? ((src[pos + i*2] << 8) | src[pos + i*2 + 1]) : src[pos + i];
+        out->rgb[i] = (v * 255 + maxval / 2) / maxval;
+    }
+    return 1;
+}
+
+static int decode(const char *src, int len, rgb_image *out) {
+    const unsigned char *s = (const unsigned char*)src;
+    if(len >= 2 && s[0] == 'B' && s[1] == 'M') {
+        return decode_bmp(s, len, out);
+    }
+    if(len >= 2 && s[0] == 'P' && s[1] == '6') {
+        return decode_ppm(s, len, out);
+    }
+    sprintf(errorstr, "Unknown image format.");
+    return 0;
+}
+
+// Bilinear scaling
+
+static void scale(const rgb_image *src, rgb_image *dst) {
+    int x, y, c;
+    for(y = 0; y < dst->h; y++) {
+        int fy = (dst->h > 1) ? (int)(((long long)y * (src->h - 1) * 256) / (dst->h - 1)) : 0;
+        int y0 = fy >> 8, wy = fy & 0xFF;
+        int y1 = (y0 + 1 < src->h) ? y0 + 1 : y0;
+        for(x = 0; x < dst->w; x++) {
+            int fx = (dst->w > 1) ? (int)(((long long)x * (src->w - 1) * 256) / (dst->w - 1)) : 0;
+            int x0 = fx >> 8, wx = fx & 0xFF;
+            int x1 = (x0 + 1 < src->w) ? x0 + 1 : x0;
+            const unsigned char *p00 = src->rgb + (y0 * src->w + x0) * 3;
+            const unsigned char *p01 = src->rgb + (y0 * src->w + x1) * 3;
+            const unsigned char *p10 = src->rgb + (y1 * src->w + x0) * 3;
+            const unsigned char *p11 = src->rgb + (y1 * src->w + x1) * 3;
+            unsigned char *d = dst->rgb + (y * dst->w + x) * 3;
+            for(c = 0; c < 3; c++) {
+                int top = p00[c] * (256 - wx) + p01[c] * wx;
+                int bot = p10[c] * (256 - wx) + p11[c] * wx;
+                d[c] = (top * (256 - wy) + bot * wy + 32768) >> 16;
+            }
+        }
+    }
+}
+
+// RGB565 conversion, optionally with Floyd-Steinberg dithering
+
+static int clamp255(int v) {
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+static void to_rgb565(const rgb_image *src, char *out, int dither) {
+    static const int bits[3] = {5, 6, 5};
+    int *err = 0;
+    int w = src->w;
+    int x, y, c;
+    if(dither) {
+        // Two rows of error per channel, with a pixel of padding on both sides
+        err = (int*)calloc(2 * (w + 2) * 3, sizeof(int));
+    }
+
+    for(y = 0; y < src->h; y++) {
+        int *cur = err ? err + (y & 1) * (w + 2) * 3 : 0;
+        int *next = err ? err + ((y + 1) & 1) * (w + 2) * 3 : 0;
+        if(next) {
+            memset(next, 0, (w + 2) * 3 * sizeof(int));
+        }
+        for(x = 0; x < w; x++) {
+            const unsigned char *p = src->rgb + (y * w + x) * 3;
+            int q[3];
+            for(c = 0; c < 3; c++) {
+                int v = p[c];
+                if(cur) {
+                    v = clamp255(v + cur[(x + 1) * 3 + c] / 16);
+                }
+                int max = (1 << bits[c]) - 1;
+                q[c] = (v * max + 127) / 255;
+                if(cur) {
+                    int e = v - (q[c] * 255 + max / 2) / max;
+                    cur[(x + 2) * 3 + c] += e * 7;
+                    next[x * 3 + c] += e * 3;
+                    next[(x + 1) * 3 + c] += e * 5;
+                    next[(x + 2) * 3 + c] += e;
+                }
+            }
+            uint16_t px = (q[0] << 11) | (q[1] << 5) | q[2];
+            out[(y * w + x) * 2] = px >> 8;
+            out[(y * w + x) * 2 + 1] = px & 0xFF;
+        }
+    }
+    free(err);
+}
+
+// Caches
+
+// Returns 0 if the image is too large or memory runs out.
+static ulcd_image* image_alloc(int w, int h) {
+    if(!size_ok(w, h, 2)) {
+        sprintf(errorstr, "Image too large.");
+        return 0;
+    }
+    ulcd_image *img = (ulcd_image*)malloc(sizeof(ulcd_image));
+    img->w = w;
+    img->h = h;
+    img->data = (char*)malloc((size_t)w * h * 2);
+    img->refs = 1;
+    if(!img->data) {
+        free(img);
+        sprintf(errorstr, "Out of memory.");
+        return 0;
+    }
+    return img;
+}
+
+static void cache_unlink(cache_entry *e) {
+    if(e->prev) e->prev->next = e->next; else cache_head = e->next;
+    if(e->next) e->next->prev = e->prev; else cache_tail = e->prev;
+    e->prev = e->next = 0;
+}
+
+static void cache_push_front(cache_entry *e) {
+    e->prev = 0;
+    e->next = cache_head;
+    if(cache_head) cache_head->prev = e;
+    cache_head = e;
+    if(!cache_tail) cache_tail = e;
+}
+
+static void cache_evict_to(int max) {
+    while(cache_count > max && cache_tail) {
+        cache_entry *e = cache_tail;
+        cache_unlink(e);
+        ulcd_image_free(e->img);
+        free(e);
+        cache_count--;
+    }
+}
+
+static ulcd_image* cache_find(uint64_t hash, int w, int h, int flags) {
+    cache_entry *e;
+    for(e = cache_head; e; e = e->next) {
+        if(e->hash == hash && e->w == w && e->h == h && e->flags == flags) {
+            cache_unlink(e);
+            cache_push_front(e);
+            e->img->refs++;
+            return e->img;
+        }
+    }
+    return 0;
+}
+
+static void cache_insert(uint64_t hash, int w, int h, int flags, ulcd_image *img) {
+    if(cache_max <= 0) {
+        return;
+    }
+    cache_entry *e = (cache_entry*)malloc(sizeof(cache_entry));
+    e->hash = hash;
+    e->w = w;
+    e->h = h;
+    e->flags = flags;
+    e->img = img;
+    img->refs++;
+    cache_push_front(e);
+    cache_count++;
+    cache_evict_to(cache_max);
+}
+
+static void disk_path(char *path, int len, uint64_t hash, int w, int h, int flags) {
+    snprintf(path, len, "%s/%08x%08x-%dx%d-%d.565", cache_dir,
+             (unsigned)(hash >> 32), (unsigned)(hash & 0xFFFFFFFF), w, h, flags);
+}
+
+// Disk cache files start with the image size as two big-endian words,
+// since the requested size may leave one or both dimensions open.
+static ulcd_image* disk_find(uint64_t hash, int w, int h, int flags) {
+    char path[512];
+    unsigned char hdr[4];
+    if(cache_dir[0] == 0) {
+        return 0;
+    }
+    disk_path(path, sizeof(path), hash, w, h, flags);
+    FILE *f = fopen(path, "rb");
+    if(!f) {
+        return 0;
+    }
+    if(fread(hdr, 1, 4, f) != 4) {
+        fclose(f);
+        return 0;
+    }
+    int iw = (hdr[0] << 8) | hdr[1];
+    int ih = (hdr[2] << 8) | hdr[3];
+    if(iw <= 0 || ih <= 0) {
+        fclose(f);
+        return 0;
+    }
+    ulcd_image *img = image_alloc(iw, ih);
+    if(!img) {
+        fclose(f);
+        return 0;
+    }
+    int ok = (fread(img->data, 1, (size_t)iw * ih * 2, f) == (size_t)iw * ih * 2);
+    fclose(f);
+    if(!ok) {
+        ulcd_image_free(img);
+        return 0;
+    }
+    return img;
+}
+
+static void disk_store(uint64_t hash, int w, int h, int flags, ulcd_image *img) {
+    char path[512], tmp[520];
+    unsigned char hdr[4];
+    if(cache_dir[0] == 0) {
+        return;
+    }
+    disk_path(path, sizeof(path), hash, w, h, flags);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if(!f) {
+        return;
+    }
+    hdr[0] = img->w >> 8;
+    hdr[1] = img->w & 0xFF;
+    hdr[2] = img->h >> 8;
+    hdr[3] = img->h & 0xFF;
+    int len = img->w * img->h * 2;
+    int ok = (fwrite(hdr, 1, 4, f) == 4) && (fwrite(img->data, 1, len, f) == (size_t)len);
+    fclose(f);
+    if(ok) {
+        rename(tmp, path);
+    } else {
+        remove(tmp);
+    }
+}
+
+// Public stuff
+
+/**
+  * Converts an in-memory BMP or PPM file to RGB565.
+  * @param w Target width, or 0
+  * @param h Target height, or 0. If both are 0 the source size is kept; if
+  *        only one is 0 it is derived from the aspect ratio.
+  * @param flags IMAGE_FLAGS
+  * @return Image to be released with ulcd_image_free(), or 0 on failure.
+  */
+ulcd_image* ulcd_image_convert(const char *src, int src_len, int w, int h, int flags) {
+    int use_cache = !(flags & ULCD_IMAGE_NO_CACHE);
+    int key_flags = flags & ~ULCD_IMAGE_NO_CACHE;
+    uint64_t hash = 0;
+    ulcd_image *img;
+
+    if(w < 0 || h < 0) {
+        sprintf(errorstr, "Invalid image size.");
+        return 0;
+    }
+
+    if(use_cache) {
+        hash = hash_data(src, src_len);
+        if((img = cache_find(hash, w, h, key_flags)) != 0) {
+            return img;
+        }
+        if((img = disk_find(hash, w, h, key_flags)) != 0) {
+            cache_insert(hash, w, h, key_flags, img);
+            return img;
+        }
+    }
+
+    rgb_image decoded;
+    if(!decode(src, src_len, &decoded)) {
+        return 0;
+    }
+
+    int tw = w, th = h;
+    if(tw == 0 && th == 0) {
+        tw = decoded.w;
+        th = decoded.h;
+    } else if(tw == 0) {
+        long long t = ((long long)decoded.w * th + decoded.h / 2) / decoded.h;
+        tw = (t > INT_MAX) ? INT_MAX : (int)t;
+    } else if(th == 0) {
+        long long t = ((long long)decoded.h * tw + decoded.w / 2) / decoded.w;
+        th = (t > INT_MAX) ? INT_MAX : (int)t;
+    }
+    if(tw <= 0) tw = 1;
+    if(th <= 0) th = 1;
+    if(tw > 0xFFFF || th > 0xFFFF || !size_ok(tw, th, 3)) {
+        free(decoded.rgb);
+        sprintf(errorstr, "Image too large.");
+        return 0;
+    }
+
+    rgb_image scaled = decoded;
+    if(tw != decoded.w || th != decoded.h) {
+        scaled.w = tw;
+        scaled.h = th;
+        scaled.rgb = (unsigned char*)malloc((size_t)tw * th * 3);
+        if(!scaled.rgb) {
+            free(decoded.rgb);
+            sprintf(errorstr, "Out of memory.");
+            return 0;
+        }
+        scale(&decoded, &scaled);
+        free(decoded.rgb);
+    }
+
+    img = image_alloc(tw, th);
+    if(!img) {
+        free(scaled.rgb);
+        return 0;
+    }
+    to_rgb565(&scaled, img->data, flags & ULCD_IMAGE_DITHER);
+    free(scaled.rgb);
+
+    if(use_cache) {
+        cache_insert(hash, w, h, key_flags, img);
+        disk_store(hash, w, h, key_flags, img);
+    }
+    return img;
+}
+
+/**
+  * Loads a BMP or PPM file and converts it to RGB565. See ulcd_image_convert().
+  */
+ulcd_image* ulcd_image_load(const char *file, int w, int h, int flags) {
+    FILE *f = fopen(file, "rb");
+    if(!f) {
+        sprintf(errorstr, "Could not open image file.");
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(len <= 0) {
+        fclose(f);
+        sprintf(errorstr, "Could not read image file.");
+        return 0;
+    }
+    char *buf = (char*)malloc(len);
+    if(fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        fclose(f);
+        sprintf(errorstr, "Could not read image file.");
+        return 0;
+    }
+    fclose(f);
+
+    ulcd_image *img = ulcd_image_convert(buf, (int)len, w, h, flags);
+    free(buf);
+    return img;
+}
+
+void ulcd_image_free(ulcd_image *img) {
+    if(img == 0) return;
+    if(--img->refs > 0) return;
+    free(img->data);
+    free(img);
+}
+
+/**
+  * Loads, converts and blits an image. If w and h are both 0 the image is
+  * scaled to the full panel size.
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_image_show(ulcd_dev *dev, const char *file, uint16_t x, uint16_t y, int w, int h, int flags) {
+    if(w == 0 && h == 0) {
+        w = dev->w;
+        h = dev->h;
+    }
+    ulcd_image *img = ulcd_image_load(file, w, h, flags);
+    if(!img) {
+        return 0;
+    }
+    int ret = ulcd_blit(dev, x, y, img->w, img->h, img->data);
+    ulcd_image_free(img);
+    return ret;
+}
+
+/**
+  * Configures the converted image caches.
+  * @param max_entries Max images kept in memory, 0 to disable. Default is 16.
+  * @param dir Directory for the on-disk cache, or 0 to disable it.
+  */
+void ulcd_image_cache_setup(int max_entries, const char *dir) {
+    cache_max = max_entries;
+    cache_evict_to(cache_max > 0 ? cache_max : 0);
+    if(dir) {
+        snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    } else {
+        cache_dir[0] = 0;
+    }
+}
+
+void ulcd_image_cache_clear() {
+    cache_evict_to(0);
+}
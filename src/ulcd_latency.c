@@ -0,0 +1,151 @@
+// For CPU affinity
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "ulcd_latency.h"
+#include "serial.h"
+
+#ifdef LINUX
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+#ifdef LINUX
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/**
+  * Applies low latency settings to the link.
+  * @param device Device name the panel was opened with, eg. /dev/ttyUSB0
+  * @param flags LATENCY_FLAGS
+  * @return 1 if every requested setting was applied, 0 otherwise.
+  */
+int ulcd_set_low_latency(ulcd_dev *dev, const char *device, int flags) {
+    int ok = 1;
+    if(flags & ULCD_LATENCY_ASYNC) {
+        if(!serial_set_low_latency(dev->port, 1)) {
+            sprintf(errorstr, "Could not set ASYNC_LOW_LATENCY: %s", serial_get_error_str());
+            ok = 0;
+        }
+    }
+    if(flags & ULCD_LATENCY_FTDI_TIMER) {
+        if(!serial_set_latency_timer(device, 1)) {
+            sprintf(errorstr, "Could not set latency timer: %s", serial_get_error_str());
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+/**
+  * Measures command round trips with the autobaud command, which has no
+  * side effects. Run it before and after tuning to compare.
+  * @return 1 on success, 0 if the panel failed to answer.
+  */
+int ulcd_measure_rtt(ulcd_dev *dev, int samples, ulcd_rtt_stats *stats) {
+    char c = 0x55;
+    int i;
+    memset(stats, 0, sizeof(ulcd_rtt_stats));
+    for(i = 0; i < samples; i++) {
+        double t0 = now_ms();
+        if(!ulcd_send_command(dev, &c, 1)) {
+            return 0;
+        }
+        double t = now_ms() - t0;
+        if(stats->samples == 0 || t < stats->min_ms) stats->min_ms = t;
+        if(t > stats->max_ms) stats->max_ms = t;
+        stats->avg_ms += t;
+        stats->samples++;
+    }
+    if(stats->samples > 0) {
+        stats->avg_ms /= stats->samples;
+    }
+    return 1;
+}
+
+/**
+  * Turns the calling thread into a real-time I/O thread: pins it to a CPU,
+  * switches it to SCHED_FIFO and locks the process memory. Needs root or
+  * CAP_SYS_NICE / CAP_IPC_LOCK.
+  * @param cpu CPU to pin to, or -1 to leave affinity alone
+  * @param priority SCHED_FIFO priority, 1-99
+  * @return 1 on success, 0 on failure.
+  */
+int ulcd_rt_promote(int cpu, int priority) {
+    int err;
+    if(cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+            sprintf(errorstr, "Could not pin thread: %s", strerror(err));
+            return 0;
+        }
+    }
+
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = priority;
+    if((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp)) != 0) {
+        sprintf(errorstr, "Could not set SCHED_FIFO: %s", strerror(err));
+        return 0;
+    }
+
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        sprintf(errorstr, "Could not lock memory: %s", strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    int cpu, priority;
+    ulcd_rt_func func;
+    void *userdata;
+    int ok;
+} rt_args;
+
+static void* rt_main(void *arg) {
+    rt_args *a = (rt_args*)arg;
+    a->ok = ulcd_rt_promote(a->cpu, a->priority);
+    if(a->ok) {
+        a->func(a->userdata);
+    }
+    return 0;
+}
+
+/**
+  * Runs func on a new real-time thread (see ulcd_rt_promote) and waits for
+  * it to return. Do all device I/O from func.
+  * @return 1 if func ran, 0 if the thread could not be set up.
+  */
+int ulcd_rt_run(int cpu, int priority, ulcd_rt_func func, void *userdata) {
+    rt_args a;
+    pthread_t t;
+    a.cpu = cpu;
+    a.priority = priority;
+    a.func = func;
+    a.userdata = userdata;
+    a.ok = 0;
+    if(pthread_create(&t, 0, rt_main, &a) != 0) {
+        sprintf(errorstr, "Could not start real-time thread.");
+        return 0;
+    }
+    pthread_join(t, 0);
+    return a.ok;
+}
+
+#endif // LINUX
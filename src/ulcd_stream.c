@@ -0,0 +1,360 @@
+#include "ulcd_stream.h"
+#include "ulcd_cost.h"
+
+#ifdef LINUX
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+#ifdef LINUX
+
+// Unchanged rows between two changed regions are sent anyway if that costs
+// fewer bytes than this, see ulcd_row_merge. About the fixed cost of a blit
+// through a USB adapter at 115200 baud, used until a cost model is set.
+#define STREAM_MERGE_BYTES 256
+
+typedef struct {
+    uint16_t x, y, w, h;
+    int offset;
+} stream_rect;
+
+typedef struct {
+    uint16_t *pixels;
+    char *wire;
+    int wire_len;
+    stream_rect *rects;
+    int nrects;
+} stream_frame;
+
+struct ulcd_stream {
+    ulcd_dev *dev;
+    uint16_t x, y, w, h;
+    ulcd_frame_source source;
+    void *userdata;
+    int policy;
+    int merge_bytes;
+
+    pthread_t producer, sender;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    int producer_started, producer_done;
+    int sender_started, sender_done;
+
+    uint16_t *next;       // Frame being filled by the source
+    uint16_t *base;       // What the panel shows once the sender is done
+    int have_base;
+    int send_full;        // Set after a failed transmission
+    stream_frame building, pending, sending;
+    int has_pending;
+
+    ulcd_stream_stats stats;
+    double started;
+    double busy;
+};
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void frame_init(stream_frame *f, int w, int h) {
+    f->pixels = (uint16_t*)malloc(w * h * sizeof(uint16_t));
+    f->wire = (char*)malloc(w * h * 2);
+    f->wire_len = 0;
+    f->rects = (stream_rect*)malloc(h * sizeof(stream_rect));
+    f->nrects = 0;
+}
+
+static void frame_free(stream_frame *f) {
+    free(f->pixels);
+    free(f->wire);
+    free(f->rects);
+}
+
+static void frame_swap(stream_frame *a, stream_frame *b) {
+    stream_frame t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void add_rect(stream_frame *f, const uint16_t *px, int stride,
+                     int x0, int y0, int x1, int y1) {
+    stream_rect *r = &f->rects[f->nrects++];
+    r->x = x0;
+    r->y = y0;
+    r->w = x1 - x0 + 1;
+    r->h = y1 - y0 + 1;
+    r->offset = f->wire_len;
+
+    int x, y;
+    char *out = f->wire + f->wire_len;
+    for(y = y0; y <= y1; y++) {
+        for(x = x0; x <= x1; x++) {
+            uint16_t p = px[y * stride + x];
+            *out++ = p >> 8;
+            *out++ = p & 0xFF;
+        }
+    }
+    f->wire_len = out - f->wire;
+}
+
+// Diffs the new frame against the panel contents and encodes the changed
+// rows as a list of blit rectangles. Takes ownership of s->next.
+static void encode_frame(ulcd_stream *s, stream_frame *f, int full, int merge_bytes) {
+    uint16_t *tmp = f->pixels;
+    f->pixels = s->next;
+    s->next = tmp;
+    f->wire_len = 0;
+    f->nrects = 0;
+
+    int w = s->w, h = s->h;
+    if(full) {
+        add_rect(f, f->pixels, w, 0, 0, w - 1, h - 1);
+        return;
+    }
+
+    int y, x;
+    ulcd_row_merge m;
+    ulcd_rect r;
+    ulcd_row_merge_init(&m, merge_bytes);
+    for(y = 0; y < h; y++) {
+        const uint16_t *a = f->pixels + y * w;
+        const uint16_t *b = s->base + y * w;
+        int lo = -1, hi = -1;
+        for(x = 0; x < w; x++) {
+            if(a[x] != b[x]) {
+                if(lo < 0) lo = x;
+                hi = x;
+            }
+        }
+        if(lo >= 0 && ulcd_row_merge_add(&m, y, lo, hi, &r)) {
+            add_rect(f, f->pixels, w, r.x0, r.y0, r.x1, r.y1);
+        }
+    }
+    if(ulcd_row_merge_finish(&m, &r)) {
+        add_rect(f, f->pixels, w, r.x0, r.y0, r.x1, r.y1);
+    }
+}
+
+static void* producer_main(void *arg) {
+    ulcd_stream *s = (ulcd_stream*)arg;
+    for(;;) {
+        if(s->source(s->userdata, s->next, s->w, s->h) <= 0) {
+            break;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        s->stats.frames_produced++;
+        if(s->has_pending) {
+            if(s->policy == ULCD_STREAM_DROP_NEWEST) {
+                s->stats.frames_dropped++;
+                pthread_mutex_unlock(&s->lock);
+                continue;
+            }
+            if(s->policy == ULCD_STREAM_DROP_OLDEST) {
+                s->stats.frames_dropped++;
+                s->has_pending = 0;
+            }
+            while(s->has_pending && !s->stop) {
+                pthread_cond_wait(&s->cond, &s->lock);
+            }
+        }
+        if(s->stop) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        int full = !s->have_base || s->send_full;
+        int merge_bytes = s->merge_bytes;
+        s->send_full = 0;
+        pthread_mutex_unlock(&s->lock);
+
+        // Nothing is pending, so the sender leaves base alone while we encode.
+        encode_frame(s, &s->building, full, merge_bytes);
+
+        pthread_mutex_lock(&s->lock);
+        frame_swap(&s->building, &s->pending);
+        s->has_pending = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->producer_done = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+static void* sender_main(void *arg) {
+    ulcd_stream *s = (ulcd_stream*)arg;
+    for(;;) {
+        pthread_mutex_lock(&s->lock);
+        while(!s->has_pending && !s->producer_done && !s->stop) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        }
+        if(!s->has_pending || s->stop) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        frame_swap(&s->pending, &s->sending);
+        s->has_pending = 0;
+        memcpy(s->base, s->sending.pixels, s->w * s->h * sizeof(uint16_t));
+        s->have_base = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+
+        int i, errors = 0;
+        double t0 = now_sec();
+        for(i = 0; i < s->sending.nrects; i++) {
+            stream_rect *r = &s->sending.rects[i];
+            if(!ulcd_blit(s->dev, s->x + r->x, s->y + r->y, r->w, r->h, s->sending.wire + r->offset)) {
+                errors++;
+            }
+        }
+        double t1 = now_sec();
+
+        pthread_mutex_lock(&s->lock);
+        s->busy += t1 - t0;
+        s->stats.frames_sent++;
+        s->stats.blits += s->sending.nrects;
+        s->stats.bytes_sent += s->sending.wire_len + s->sending.nrects * 10;
+        s->stats.errors += errors;
+        if(errors) {
+            // The panel may not show what base says anymore. Send a full frame next.
+            s->send_full = 1;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->sender_done = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+/**
+  * Starts streaming frames to a region of the panel. The device must not be
+  * used by anything else until the stream is stopped.
+  * @param source Called from the producer thread for each frame
+  * @param policy STREAM_POLICY
+  * @return Stream handle, or 0 on failure.
+  */
+ulcd_stream* ulcd_stream_start(ulcd_dev *dev,
+                               uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                               ulcd_frame_source source, void *userdata,
+                               int policy) {
+    if(w == 0 || h == 0 || source == 0) {
+        sprintf(errorstr, "Invalid stream parameters.");
+        return 0;
+    }
+
+    ulcd_stream *s = (ulcd_stream*)malloc(sizeof(ulcd_stream));
+    memset(s, 0, sizeof(ulcd_stream));
+    s->dev = dev;
+    s->x = x;
+    s->y = y;
+    s->w = w;
+    s->h = h;
+    s->source = source;
+    s->userdata = userdata;
+    s->policy = policy;
+    s->merge_bytes = STREAM_MERGE_BYTES;
+    s->next = (uint16_t*)malloc(w * h * sizeof(uint16_t));
+    s->base = (uint16_t*)malloc(w * h * sizeof(uint16_t));
+    frame_init(&s->building, w, h);
+    frame_init(&s->pending, w, h);
+    frame_init(&s->sending, w, h);
+    pthread_mutex_init(&s->lock, 0);
+    pthread_cond_init(&s->cond, 0);
+    s->started = now_sec();
+
+    if(pthread_create(&s->sender, 0, sender_main, s) != 0) {
+        sprintf(errorstr, "Could not start sender thread.");
+        s->sender_done = 1;
+        ulcd_stream_stop(s);
+        return 0;
+    }
+    s->sender_started = 1;
+    if(pthread_create(&s->producer, 0, producer_main, s) != 0) {
+        sprintf(errorstr, "Could not start producer thread.");
+        ulcd_stream_stop(s);
+        return 0;
+    }
+    s->producer_started = 1;
+    return s;
+}
+
+/**
+  * Waits until the source has ended and every frame has been sent.
+  * @return 1 if all frames were sent without errors, 0 otherwise.
+  */
+int ulcd_stream_wait(ulcd_stream *s) {
+    pthread_mutex_lock(&s->lock);
+    while(!s->sender_done) {
+        pthread_cond_wait(&s->cond, &s->lock);
+    }
+    int ok = (s->stats.errors == 0);
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+/**
+  * Stops the stream and frees it. Waits for the current frame source call
+  * and transmission to finish.
+  */
+void ulcd_stream_stop(ulcd_stream *s) {
+    if(s == 0) return;
+
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+
+    if(s->producer_started) pthread_join(s->producer, 0);
+    if(s->sender_started) pthread_join(s->sender, 0);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    frame_free(&s->building);
+    frame_free(&s->pending);
+    frame_free(&s->sending);
+    free(s->next);
+    free(s->base);
+    free(s);
+}
+
+/**
+  * Sizes the merging of changed regions for the panel's link, see
+  * ulcd_cost_merge_bytes. Takes effect from the next frame.
+  * @param model Cost model, or 0 for the built-in default
+  */
+void ulcd_stream_set_cost_model(ulcd_stream *s, const ulcd_cost_model *model) {
+    int merge = model ? ulcd_cost_merge_bytes(model) : 0;
+    pthread_mutex_lock(&s->lock);
+    s->merge_bytes = merge > 0 ? merge : STREAM_MERGE_BYTES;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void ulcd_stream_get_stats(ulcd_stream *s, ulcd_stream_stats *stats) {
+    pthread_mutex_lock(&s->lock);
+    *stats = s->stats;
+    double busy = s->busy;
+    pthread_mutex_unlock(&s->lock);
+
+    double elapsed = now_sec() - s->started;
+    if(elapsed > 0) {
+        stats->fps = stats->frames_sent / elapsed;
+        stats->link_utilisation = busy / elapsed;
+    }
+}
+
+#endif // LINUX
@@ -0,0 +1,124 @@
+#include "ulcd_touch.h"
+
+#ifdef LINUX
+#include <unistd.h>
+#include <time.h>
+#else
+#include <windows.h>
+#endif
+
+static long now_ms() {
+#ifdef LINUX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+    return GetTickCount();
+#endif
+}
+
+static void push_event(ulcd_touch_poller *p, const ulcd_event *ev) {
+    // Merge with an unread move event, the app only cares where it ended up.
+    if(ev->type == ULCD_TOUCH_MOVING && p->count > 0) {
+        ulcd_event *last = &p->queue[(p->head + p->count - 1) % ULCD_TOUCH_QUEUE];
+        if(last->type == ULCD_TOUCH_MOVING) {
+            *last = *ev;
+            return;
+        }
+    }
+    if(p->count == ULCD_TOUCH_QUEUE) {
+        p->head = (p->head + 1) % ULCD_TOUCH_QUEUE;
+        p->count--;
+    }
+    p->queue[(p->head + p->count) % ULCD_TOUCH_QUEUE] = *ev;
+    p->count++;
+}
+
+/**
+  * Sets up a poller.
+  * @param min_interval_ms Poll interval while the screen is touched, 0 for every call
+  * @param max_interval_ms Longest interval the poller backs off to when idle
+  */
+void ulcd_touch_init(ulcd_touch_poller *p, ulcd_dev *dev, int min_interval_ms, int max_interval_ms) {
+    p->dev = dev;
+    p->min_interval = (min_interval_ms < 0) ? 0 : min_interval_ms;
+    p->max_interval = (max_interval_ms < p->min_interval) ? p->min_interval : max_interval_ms;
+    p->interval = p->min_interval;
+    p->next_poll = 0;
+    p->touching = 0;
+    p->head = 0;
+    p->count = 0;
+}
+
+/**
+  * Queries the panel if the poll interval has passed. Call this from the main
+  * loop as often as convenient; it does not touch the link before it is due.
+  * The coordinate query is only sent when the status shows activity.
+  * @return Number of events waiting in the queue.
+  */
+int ulcd_touch_poll(ulcd_touch_poller *p) {
+    long now = now_ms();
+    if(now < p->next_poll) {
+        return p->count;
+    }
+
+    ulcd_event ev;
+    ulcd_get_event(p->dev, &ev);
+    if(ev.type == ULCD_TOUCH_PRESS || ev.type == ULCD_TOUCH_MOVING) {
+        p->touching = 1;
+    } else if(ev.type == ULCD_TOUCH_RELEASE) {
+        p->touching = 0;
+    }
+
+    if(ev.type > ULCD_NO_ACTIVITY && ev.type <= ULCD_TOUCH_MOVING) {
+        push_event(p, &ev);
+        p->interval = p->min_interval;
+    } else if(!p->touching) {
+        // Back off: 1, 2, 4, ... ms up to the maximum.
+        p->interval = (p->interval > 0) ? p->interval * 2 : 1;
+        if(p->interval > p->max_interval) {
+            p->interval = p->max_interval;
+        }
+    }
+    p->next_poll = now + p->interval;
+    return p->count;
+}
+
+/**
+  * Takes the oldest queued event.
+  * @return 1 if an event was returned, 0 if the queue is empty.
+  */
+int ulcd_touch_get(ulcd_touch_poller *p, ulcd_event *event) {
+    if(p->count == 0) {
+        return 0;
+    }
+    *event = p->queue[p->head];
+    p->head = (p->head + 1) % ULCD_TOUCH_QUEUE;
+    p->count--;
+    return 1;
+}
+
+/**
+  * @return Milliseconds until the next poll is due, 0 if it is due now.
+  */
+int ulcd_touch_next_poll_ms(ulcd_touch_poller *p) {
+    long left = p->next_poll - now_ms();
+    return (left > 0) ? (int)left : 0;
+}
+
+/**
+  * Blocks until an event is available, sleeping between polls.
+  */
+void ulcd_touch_wait(ulcd_touch_poller *p, ulcd_event *event) {
+    while(!ulcd_touch_get(p, event)) {
+        int left = ulcd_touch_next_poll_ms(p);
+        if(left > 0) {
+#ifdef LINUX
+            usleep(left * 1000);
+#else
+            Sleep(left);
+#endif
+        }
+        ulcd_touch_poll(p);
+    }
+}
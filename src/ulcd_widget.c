@@ -0,0 +1,493 @@
+#include "ulcd_widget.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+extern char errorstr[256];
+
+// Grid cell size for touch hit-testing, in pixels
+#define UI_CELL 32
+
+enum {
+    DIRTY_NONE = 0,
+    DIRTY_VALUE,  // Only the value part (gauge level, checkbox mark) changed
+    DIRTY_FULL,
+};
+
+typedef struct {
+    ulcd_widget **items;
+    int count;
+} ui_cell;
+
+struct ulcd_ui {
+    ulcd_dev *dev;
+    uint16_t bg;
+    ulcd_widget **widgets;
+    int count;
+    ulcd_widget *captured;
+    ui_cell *grid;
+    int cols, rows;
+};
+
+// Helpers
+
+static void mark(ulcd_widget *wd, int level) {
+    if(wd->dirty < level) {
+        wd->dirty = level;
+    }
+}
+
+static int overlaps(const ulcd_widget *a, const ulcd_widget *b) {
+    return a->x < b->x + b->w && b->x < a->x + a->w
+        && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+static int contains(const ulcd_widget *wd, int x, int y) {
+    return x >= wd->x && x < wd->x + wd->w && y >= wd->y && y < wd->y + wd->h;
+}
+
+static int set_pen(ulcd_ui *ui, int style) {
+    if(ui->dev->pen == style) {
+        return 1;
+    }
+    return ulcd_pen_style(ui->dev, style);
+}
+
+static int fill(ulcd_ui *ui, int x0, int y0, int x1, int y1, uint16_t color) {
+    if(x1 < x0 || y1 < y0) {
+        return 1;
+    }
+    return ulcd_draw_rect(ui->dev, x0, y0, x1, y1, color);
+}
+
+// Width of the gauge fill for a given value
+static int gauge_fill(const ulcd_widget *wd, int value) {
+    int inner = wd->w - 2;
+    if(wd->max <= 0 || inner <= 0) return 0;
+    if(value < 0) value = 0;
+    if(value > wd->max) value = wd->max;
+    return inner * value / wd->max;
+}
+
+// Painting. Solid fills first, then outlines, then text, so a repaint of
+// widgets that don't overlap costs at most two pen style changes however many
+// are dirty, and one more to put back the caller's style.
+
+static int paint_fills(ulcd_ui *ui, ulcd_widget *wd) {
+    int x0 = wd->x, y0 = wd->y;
+    int x1 = wd->x + wd->w - 1, y1 = wd->y + wd->h - 1;
+    int ok = 1;
+
+    switch(wd->type) {
+        case ULCD_WIDGET_LABEL:
+            if(wd->dirty == DIRTY_FULL) {
+                ok &= fill(ui, x0, y0, x1, y1, wd->bg);
+            }
+            break;
+        case ULCD_WIDGET_BUTTON:
+            if(wd->dirty == DIRTY_FULL) {
+                ok &= fill(ui, x0, y0, x1, y1, wd->pressed ? wd->fg : wd->bg);
+            }
+            break;
+        case ULCD_WIDGET_GAUGE: {
+            int now = gauge_fill(wd, wd->value);
+            if(wd->dirty == DIRTY_FULL) {
+                ok &= fill(ui, x0 + 1, y0 + 1, x0 + now, y1 - 1, wd->fg);
+                ok &= fill(ui, x0 + 1 + now, y0 + 1, x1 - 1, y1 - 1, wd->bg);
+            } else {
+                // Only the part between the old and the new level
+                int was = gauge_fill(wd, wd->drawn_value);
+                if(now > was) {
+                    ok &= fill(ui, x0 + 1 + was, y0 + 1, x0 + now, y1 - 1, wd->fg);
+                } else if(now < was) {
+                    ok &= fill(ui, x0 + 1 + now, y0 + 1, x0 + was, y1 - 1, wd->bg);
+                }
+            }
+            break;
+        }
+        case ULCD_WIDGET_CHECKBOX: {
+            int box = wd->h;
+            if(wd->dirty == DIRTY_FULL) {
+                ok &= fill(ui, x0, y0, x1, y1, wd->bg);
+            }
+            ok &= fill(ui, x0 + 3, y0 + 3, x0 + box - 4, y0 + box - 4, wd->value ? wd->fg : wd->bg);
+            break;
+        }
+    }
+    return ok;
+}
+
+static int paint_outlines(ulcd_ui *ui, ulcd_widget *wd) {
+    int x0 = wd->x, y0 = wd->y;
+    int x1 = wd->x + wd->w - 1, y1 = wd->y + wd->h - 1;
+    switch(wd->type) {
+        case ULCD_WIDGET_BUTTON:
+        case ULCD_WIDGET_GAUGE:
+            return ulcd_draw_rect(ui->dev, x0, y0, x1, y1, wd->fg);
+        case ULCD_WIDGET_CHECKBOX:
+            return ulcd_draw_rect(ui->dev, x0, y0, x0 + wd->h - 1, y1, wd->fg);
+    }
+    return 1;
+}
+
+static int paint_text(ulcd_ui *ui, ulcd_widget *wd) {
+    if(wd->text[0] == 0 || wd->type == ULCD_WIDGET_GAUGE) {
+        return 1;
+    }
+    int cw, ch;
+    ulcd_text_metrics(wd->font, &cw, &ch);
+    int len = strlen(wd->text);
+    int x = wd->x + 2, y = wd->y + (wd->h - ch) / 2;
+    uint16_t color = wd->fg;
+
+    if(wd->type == ULCD_WIDGET_BUTTON) {
+        x = wd->x + (wd->w - len * cw) / 2;
+        if(wd->pressed) {
+            color = wd->bg;
+        }
+    } else if(wd->type == ULCD_WIDGET_CHECKBOX) {
+        x = wd->x + wd->h + 4;
+    }
+    if(x < wd->x) x = wd->x;
+    if(y < wd->y) y = wd->y;
+    return ulcd_draw_text(ui->dev, wd->text, x, y, wd->font, color);
+}
+
+// Grid
+
+static void grid_insert(ulcd_ui *ui, ulcd_widget *wd) {
+    int c0 = wd->x / UI_CELL, c1 = (wd->x + wd->w - 1) / UI_CELL;
+    int r0 = wd->y / UI_CELL, r1 = (wd->y + wd->h - 1) / UI_CELL;
+    int r, c;
+    if(c1 >= ui->cols) c1 = ui->cols - 1;
+    if(r1 >= ui->rows) r1 = ui->rows - 1;
+    for(r = r0; r <= r1; r++) {
+        for(c = c0; c <= c1; c++) {
+            ui_cell *cell = &ui->grid[r * ui->cols + c];
+            cell->items = (ulcd_widget**)realloc(cell->items, sizeof(ulcd_widget*) * (cell->count + 1));
+            cell->items[cell->count++] = wd;
+        }
+    }
+}
+
+// Topmost (last added) visible interactive widget under a point
+static ulcd_widget* grid_find(ulcd_ui *ui, int x, int y) {
+    if(x < 0 || y < 0) return 0;
+    int c = x / UI_CELL, r = y / UI_CELL;
+    if(c >= ui->cols || r >= ui->rows) return 0;
+    ui_cell *cell = &ui->grid[r * ui->cols + c];
+    int i;
+    for(i = cell->count - 1; i >= 0; i--) {
+        ulcd_widget *wd = cell->items[i];
+        if(wd->visible && contains(wd, x, y)
+           && (wd->type == ULCD_WIDGET_BUTTON || wd->type == ULCD_WIDGET_CHECKBOX)) {
+            return wd;
+        }
+    }
+    return 0;
+}
+
+// Public stuff
+
+/**
+  * Creates an empty widget tree for a device.
+  * @param bg Screen background colour, used when widgets are hidden
+  */
+ulcd_ui* ulcd_ui_create(ulcd_dev *dev, uint16_t bg) {
+    ulcd_ui *ui = (ulcd_ui*)malloc(sizeof(ulcd_ui));
+    ui->dev = dev;
+    ui->bg = bg;
+    ui->widgets = 0;
+    ui->count = 0;
+    ui->captured = 0;
+    ui->cols = (dev->w + UI_CELL - 1) / UI_CELL;
+    ui->rows = (dev->h + UI_CELL - 1) / UI_CELL;
+    if(ui->cols < 1) ui->cols = 1;
+    if(ui->rows < 1) ui->rows = 1;
+    ui->grid = (ui_cell*)calloc(ui->cols * ui->rows, sizeof(ui_cell));
+    return ui;
+}
+
+void ulcd_ui_free(ulcd_ui *ui) {
+    if(ui == 0) return;
+    int i;
+    for(i = 0; i < ui->cols * ui->rows; i++) {
+        free(ui->grid[i].items);
+    }
+    for(i = 0; i < ui->count; i++) {
+        free(ui->widgets[i]);
+    }
+    free(ui->grid);
+    free(ui->widgets);
+    free(ui);
+}
+
+/**
+  * Adds a widget. Widgets added later are on top of earlier ones.
+  * @return The new widget, owned by the ui.
+  */
+ulcd_widget* ulcd_ui_add(ulcd_ui *ui, int type,
+                         uint16_t x, uint16_t y,
+                         uint16_t w, uint16_t h,
+                         const char *text) {
+    if(w == 0 || h == 0) {
+        sprintf(errorstr, "Invalid widget size.");
+        return 0;
+    }
+    ulcd_widget *wd = (ulcd_widget*)malloc(sizeof(ulcd_widget));
+    memset(wd, 0, sizeof(ulcd_widget));
+    wd->ui = ui;
+    wd->type = type;
+    wd->x = x;
+    wd->y = y;
+    wd->w = w;
+    wd->h = h;
+    wd->fg = 0xFFFF;
+    wd->bg = ui->bg;
+    wd->max = 100;
+    wd->visible = 1;
+    wd->dirty = DIRTY_FULL;
+    if(text) {
+        snprintf(wd->text, sizeof(wd->text), "%s", text);
+    }
+
+    ui->widgets = (ulcd_widget**)realloc(ui->widgets, sizeof(ulcd_widget*) * (ui->count + 1));
+    ui->widgets[ui->count++] = wd;
+    grid_insert(ui, wd);
+    return wd;
+}
+
+static int needs_paint(const ulcd_widget *wd) {
+    return wd->visible && wd->dirty;
+}
+
+// Paints the dirty widgets in ui->widgets[start..end), which don't overlap
+// each other. The pen style is only changed for the steps that draw
+// something.
+static int paint_range(ulcd_ui *ui, int start, int end) {
+    int i, ok = 1, fills = 0, outlines = 0;
+    for(i = start; i < end; i++) {
+        ulcd_widget *wd = ui->widgets[i];
+        if(needs_paint(wd)) {
+            fills = 1;
+            if(wd->dirty == DIRTY_FULL && wd->type != ULCD_WIDGET_LABEL) {
+                outlines = 1;
+            }
+        }
+    }
+    if(fills) {
+        ok &= set_pen(ui, ULCD_PEN_SOLID);
+        for(i = start; i < end; i++) {
+            if(needs_paint(ui->widgets[i])) {
+                ok &= paint_fills(ui, ui->widgets[i]);
+            }
+        }
+    }
+    if(outlines) {
+        ok &= set_pen(ui, ULCD_PEN_WIREFRAME);
+        for(i = start; i < end; i++) {
+            if(needs_paint(ui->widgets[i]) && ui->widgets[i]->dirty == DIRTY_FULL) {
+                ok &= paint_outlines(ui, ui->widgets[i]);
+            }
+        }
+    }
+    for(i = start; i < end; i++) {
+        ulcd_widget *wd = ui->widgets[i];
+        if(wd->visible && wd->dirty == DIRTY_FULL) {
+            ok &= paint_text(ui, wd);
+        }
+        if(wd->visible) {
+            wd->dirty = DIRTY_NONE;
+            wd->drawn_value = wd->value;
+        }
+    }
+    return ok;
+}
+
+/**
+  * Repaints the widgets whose state has changed since the last paint.
+  * Widgets on top of a repainted one are repainted as well. The pen style is
+  * left as it was found, or solid if it was not known.
+  * @return 1 on success, 0 if any drawing command failed.
+  */
+int ulcd_ui_paint(ulcd_ui *ui) {
+    int i, j, ok = 1, any = 0;
+    int pen = (ui->dev->pen == ULCD_PEN_WIREFRAME) ? ULCD_PEN_WIREFRAME : ULCD_PEN_SOLID;
+
+    // Painting or erasing a widget draws over the widgets added after it that
+    // overlap it, so they need a full repaint too.
+    for(i = 0; i < ui->count; i++) {
+        if(!ui->widgets[i]->dirty) continue;
+        for(j = i + 1; j < ui->count; j++) {
+            if(ui->widgets[j]->visible && overlaps(ui->widgets[i], ui->widgets[j])) {
+                mark(ui->widgets[j], DIRTY_FULL);
+            }
+        }
+    }
+
+    // Erase hidden widgets first, so whatever was under them is drawn on top.
+    for(i = 0; i < ui->count; i++) {
+        ulcd_widget *wd = ui->widgets[i];
+        if(!wd->visible && wd->dirty) {
+            ok &= set_pen(ui, ULCD_PEN_SOLID);
+            ok &= fill(ui, wd->x, wd->y, wd->x + wd->w - 1, wd->y + wd->h - 1, ui->bg);
+            wd->dirty = DIRTY_NONE;
+        }
+        if(needs_paint(wd)) {
+            any = 1;
+        }
+    }
+
+    // Paint in bottom to top runs of widgets that don't overlap. Within a run
+    // fills, outlines and text are grouped to save pen changes; a widget that
+    // overlaps one already in the run starts a new run so it ends up on top.
+    int start = any ? 0 : ui->count;
+    while(start < ui->count) {
+        int end;
+        for(end = start; end < ui->count; end++) {
+            if(!needs_paint(ui->widgets[end])) continue;
+            for(j = start; j < end; j++) {
+                if(needs_paint(ui->widgets[j]) && overlaps(ui->widgets[j], ui->widgets[end])) break;
+            }
+            if(j < end) break;
+        }
+        ok &= paint_range(ui, start, end);
+        start = end;
+    }
+    if(ui->dev->pen != pen) {
+        ok &= ulcd_pen_style(ui->dev, pen);
+    }
+    return ok;
+}
+
+/**
+  * Marks every widget for repainting, eg. after the screen was cleared.
+  */
+void ulcd_ui_invalidate(ulcd_ui *ui) {
+    int i;
+    for(i = 0; i < ui->count; i++) {
+        mark(ui->widgets[i], DIRTY_FULL);
+    }
+}
+
+/**
+  * Routes a touch event to the widget under it. Buttons fire their callback
+  * when released over them, checkboxes toggle.
+  * @return 1 if a widget used the event, 0 otherwise.
+  */
+int ulcd_ui_dispatch(ulcd_ui *ui, const ulcd_event *ev) {
+    ulcd_widget *wd;
+    switch(ev->type) {
+        case ULCD_TOUCH_PRESS:
+            wd = grid_find(ui, ev->x, ev->y);
+            ui->captured = wd;
+            if(wd && wd->type == ULCD_WIDGET_BUTTON) {
+                wd->pressed = 1;
+                mark(wd, DIRTY_FULL);
+            }
+            return wd != 0;
+        case ULCD_TOUCH_MOVING:
+            wd = ui->captured;
+            if(wd && wd->type == ULCD_WIDGET_BUTTON) {
+                int inside = contains(wd, ev->x, ev->y);
+                if(inside != wd->pressed) {
+                    wd->pressed = inside;
+                    mark(wd, DIRTY_FULL);
+                }
+            }
+            return wd != 0;
+        case ULCD_TOUCH_RELEASE:
+            wd = ui->captured;
+            ui->captured = 0;
+            if(wd == 0) {
+                return 0;
+            }
+            if(wd->type == ULCD_WIDGET_BUTTON && wd->pressed) {
+                wd->pressed = 0;
+                mark(wd, DIRTY_FULL);
+            }
+            if(contains(wd, ev->x, ev->y)) {
+                if(wd->type == ULCD_WIDGET_CHECKBOX) {
+                    ulcd_widget_set_value(wd, !wd->value);
+                }
+                if(wd->cb) {
+                    wd->cb(wd, wd->userdata);
+                }
+            }
+            return 1;
+    }
+    return 0;
+}
+
+void ulcd_widget_set_text(ulcd_widget *wd, const char *text) {
+    if(strncmp(wd->text, text, sizeof(wd->text) - 1) == 0) {
+        return;
+    }
+    snprintf(wd->text, sizeof(wd->text), "%s", text);
+    mark(wd, DIRTY_FULL);
+}
+
+void ulcd_widget_set_value(ulcd_widget *wd, int value) {
+    if(wd->value == value) {
+        return;
+    }
+    wd->value = value;
+    mark(wd, DIRTY_VALUE);
+}
+
+void ulcd_widget_set_range(ulcd_widget *wd, int max) {
+    if(wd->max == max) {
+        return;
+    }
+    wd->max = max;
+    mark(wd, DIRTY_FULL);
+}
+
+void ulcd_widget_set_colors(ulcd_widget *wd, uint16_t fg, uint16_t bg) {
+    if(wd->fg == fg && wd->bg == bg) {
+        return;
+    }
+    wd->fg = fg;
+    wd->bg = bg;
+    mark(wd, DIRTY_FULL);
+}
+
+void ulcd_widget_set_font(ulcd_widget *wd, int font) {
+    if(font < 0 || font > 3 || wd->font == font) {
+        return;
+    }
+    wd->font = font;
+    mark(wd, DIRTY_FULL);
+}
+
+/**
+  * Shows or hides a widget. Hidden widgets are erased with the screen
+  * background, and widgets under them are repainted.
+  */
+void ulcd_widget_set_visible(ulcd_widget *wd, int visible) {
+    visible = visible ? 1 : 0;
+    if(wd->visible == visible) {
+        return;
+    }
+    wd->visible = visible;
+    wd->dirty = DIRTY_FULL;
+    if(!visible) {
+        int i;
+        ulcd_ui *ui = wd->ui;
+        for(i = 0; i < ui->count; i++) {
+            ulcd_widget *other = ui->widgets[i];
+            if(other != wd && other->visible && overlaps(wd, other)) {
+                mark(other, DIRTY_FULL);
+            }
+        }
+        if(ui->captured == wd) {
+            ui->captured = 0;
+        }
+    }
+}
+
+void ulcd_widget_set_callback(ulcd_widget *wd, ulcd_widget_cb cb, void *userdata) {
+    wd->cb = cb;
+    wd->userdata = userdata;
+}
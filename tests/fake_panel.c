@@ -0,0 +1,288 @@
+#include "test.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <malloc.h>
+#include <string.h>
+
+int test_failures = 0;
+
+int test_result(const char *name) {
+    if(test_failures) {
+        printf("%s: %d check(s) failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+int fake_word(const fake_cmd *c, int offset) {
+    return (c->head[offset] << 8) | c->head[offset + 1];
+}
+
+static int word_at(const unsigned char *b, int offset) {
+    return (b[offset] << 8) | b[offset + 1];
+}
+
+// Bytes in the command starting at b, 0 if more are needed to tell or -1
+// for an unknown opcode.
+static long command_len(const unsigned char *b, long n) {
+    long i;
+    switch(b[0]) {
+        case 0x45: case 0x55: return 1;
+        case 0x70: case 0x6F: return 2;
+        case 0x59: return 3;
+        case 0x52: return 5;
+        case 0x50: return 7;
+        case 0x43: return 9;
+        case 0x4C: case 0x72: case 0x65: return 11;
+        case 0x6B: return 13;
+        case 0x53:
+            for(i = 10; i < n; i++) {
+                if(b[i] == 0) return i + 1;
+            }
+            return 0;
+        case 0x49:
+            if(n < 10) return 0;
+            return 10 + (long)word_at(b, 5) * word_at(b, 7) * 2;
+    }
+    return -1;
+}
+
+static void put(fake_panel *p, int x, int y, uint16_t c) {
+    if(x >= 0 && y >= 0 && x < p->w && y < p->h) {
+        p->fb[y * p->w + x] = c;
+    }
+}
+
+static void draw_rect(fake_panel *p, int x0, int y0, int x1, int y1, uint16_t c) {
+    int x, y;
+    for(y = y0; y <= y1; y++) {
+        for(x = x0; x <= x1; x++) {
+            if(p->pen == ULCD_PEN_SOLID || x == x0 || x == x1 || y == y0 || y == y1) {
+                put(p, x, y, c);
+            }
+        }
+    }
+}
+
+static void write_words(fake_panel *p, int a, int b) {
+    unsigned char r[4] = { a >> 8, a & 0xFF, b >> 8, b & 0xFF };
+    if(write(p->fd, r, 4) != 4) {
+        perror("fake panel");
+    }
+}
+
+// Runs one complete command and answers it.
+static void execute(fake_panel *p, const unsigned char *b, long len) {
+    int x, y;
+    pthread_mutex_lock(&p->lock);
+    if(p->count < FAKE_MAX_CMDS) {
+        fake_cmd *c = &p->cmds[p->count++];
+        c->op = b[0];
+        c->len = len;
+        memcpy(c->head, b, len < 16 ? len : 16);
+    }
+    p->bytes += len;
+    if(p->delay_us > 0) {
+        usleep(p->delay_us);
+    }
+    if(p->late_us > 0) {
+        usleep(p->late_us);
+        p->late_us = 0;
+    }
+    if(p->nak > 0 && b[0] != 0x55) {
+        char nak = 0x15;
+        p->nak--;
+        if(write(p->fd, &nak, 1) != 1) perror("fake panel");
+        pthread_mutex_unlock(&p->lock);
+        return;
+    }
+
+    switch(b[0]) {
+        case 0x45:
+            memset(p->fb, 0, p->w * p->h * 2);
+            break;
+        case 0x70:
+            p->pen = b[1];
+            break;
+        case 0x50:
+            put(p, word_at(b, 1), word_at(b, 3), word_at(b, 5));
+            break;
+        case 0x72:
+            draw_rect(p, word_at(b, 1), word_at(b, 3), word_at(b, 5), word_at(b, 7), word_at(b, 9));
+            break;
+        case 0x6B:
+            for(y = word_at(b, 3); y <= word_at(b, 7); y++) {
+                for(x = word_at(b, 1); x <= word_at(b, 5); x++) {
+                    if(x < p->w && y < p->h && p->fb[y * p->w + x] == word_at(b, 9)) {
+                        p->fb[y * p->w + x] = word_at(b, 11);
+                    }
+                }
+            }
+            break;
+        case 0x49: {
+            int x0 = word_at(b, 1), y0 = word_at(b, 3), w = word_at(b, 5), h = word_at(b, 7);
+            for(y = 0; y < h; y++) {
+                for(x = 0; x < w; x++) {
+                    put(p, x0 + x, y0 + y, word_at(b, 10 + (y * w + x) * 2));
+                }
+            }
+            break;
+        }
+    }
+
+    // Replies are written under the lock, so a command is logged and drawn
+    // by the time the driver call that sent it returns.
+    if(b[0] == 0x6F && b[1] == 0x04) {
+        write_words(p, p->touch_type, 0);
+    } else if(b[0] == 0x6F) {
+        write_words(p, p->touch_x, p->touch_y);
+    } else if(b[0] == 0x52) {
+        int c = fake_panel_pixel(p, word_at(b, 1), word_at(b, 3));
+        unsigned char r[2] = { c >> 8, c & 0xFF };
+        if(write(p->fd, r, 2) != 2) perror("fake panel");
+    } else {
+        char ack = 0x06;
+        if(write(p->fd, &ack, 1) != 1) perror("fake panel");
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void* panel_main(void *arg) {
+    fake_panel *p = (fake_panel*)arg;
+    long cap = 65536, n = 0;
+    unsigned char *buf = (unsigned char*)malloc(cap);
+    for(;;) {
+        pthread_mutex_lock(&p->lock);
+        int paused = p->paused;
+        pthread_mutex_unlock(&p->lock);
+        if(paused) {
+            usleep(1000);
+            continue;
+        }
+        if(n == cap) {
+            cap *= 2;
+            buf = (unsigned char*)realloc(buf, cap);
+        }
+        int got = read(p->fd, buf + n, cap - n);
+        if(got <= 0) {
+            break;
+        }
+        n += got;
+
+        long used = 0;
+        while(used < n) {
+            long len = command_len(buf + used, n - used);
+            if(len < 0) {
+                // Unknown opcode: NAK it and skip the byte
+                char nak = 0x15;
+                if(write(p->fd, &nak, 1) != 1) perror("fake panel");
+                used++;
+                continue;
+            }
+            if(len == 0 || len > n - used) {
+                if(len > cap) {
+                    cap = len;
+                    buf = (unsigned char*)realloc(buf, cap);
+                }
+                break;
+            }
+            execute(p, buf + used, len);
+            used += len;
+        }
+        memmove(buf, buf + used, n - used);
+        n -= used;
+    }
+    free(buf);
+    return 0;
+}
+
+/**
+  * Starts a fake panel of the given size. The driver side of the link is
+  * non-blocking like a serial port opened by serial_open().
+  */
+fake_panel* fake_panel_open(int w, int h) {
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        return 0;
+    }
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+
+    fake_panel *p = (fake_panel*)calloc(1, sizeof(fake_panel));
+    p->port.ok = 1;
+    p->port.handle = sv[0];
+    p->dev.port = &p->port;
+    strcpy(p->dev.name, "fake");
+    p->dev.type = 1;
+    p->dev.w = w;
+    p->dev.h = h;
+    p->dev.timeout = 500;
+    p->dev.retries = 0;
+    p->dev.pen = -1;
+    p->fd = sv[1];
+    p->w = w;
+    p->h = h;
+    p->fb = (uint16_t*)calloc(w * h, 2);
+    pthread_mutex_init(&p->lock, 0);
+    pthread_create(&p->thread, 0, panel_main, p);
+    return p;
+}
+
+void fake_panel_close(fake_panel *p) {
+    pthread_mutex_lock(&p->lock);
+    p->paused = 0;
+    pthread_mutex_unlock(&p->lock);
+    close(p->port.handle);
+    pthread_join(p->thread, 0);
+    close(p->fd);
+    pthread_mutex_destroy(&p->lock);
+    free(p->fb);
+    free(p);
+}
+
+// Forgets the logged commands.
+void fake_panel_reset(fake_panel *p) {
+    pthread_mutex_lock(&p->lock);
+    p->count = 0;
+    p->bytes = 0;
+    pthread_mutex_unlock(&p->lock);
+}
+
+int fake_panel_count(fake_panel *p, int op) {
+    int i, n = 0;
+    pthread_mutex_lock(&p->lock);
+    for(i = 0; i < p->count; i++) {
+        if(p->cmds[i].op == op) n++;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return n;
+}
+
+// @return The nth logged command with opcode op, or 0.
+const fake_cmd* fake_panel_find(fake_panel *p, int op, int nth) {
+    int i;
+    for(i = 0; i < p->count; i++) {
+        if(p->cmds[i].op == op && nth-- == 0) {
+            return &p->cmds[i];
+        }
+    }
+    return 0;
+}
+
+uint16_t fake_panel_pixel(fake_panel *p, int x, int y) {
+    if(x < 0 || y < 0 || x >= p->w || y >= p->h) {
+        return 0;
+    }
+    return p->fb[y * p->w + x];
+}
+
+void fake_panel_touch(fake_panel *p, int type, int x, int y) {
+    pthread_mutex_lock(&p->lock);
+    p->touch_type = type;
+    p->touch_x = x;
+    p->touch_y = y;
+    pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,77 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "ulcd_driver.h"
+#include "serial.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Small test support. Each test program checks with CHECK() and returns
+// test_result() from main.
+
+extern int test_failures;
+
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while(0)
+
+int test_result(const char *name);
+
+// Fake panel on the other end of a socketpair. Commands are parsed, logged
+// and answered with an ACK. Clears, pixels, rectangles, blits and colour
+// replacements are drawn into a framebuffer the tests can inspect; other
+// drawing is only logged. Touch queries are answered from the fields set
+// with fake_panel_touch(). delay_us, late_us, nak and paused may be set
+// while the panel runs, under its lock.
+
+#define FAKE_MAX_CMDS 4096
+
+typedef struct {
+    int op;
+    int len;                 // Bytes on the wire, including the opcode
+    unsigned char head[16];  // First bytes of the command
+} fake_cmd;
+
+typedef struct {
+    ulcd_dev dev;            // Device to pass to the driver
+    serial_port port;
+    int fd;                  // Panel side of the socketpair
+    int w, h;
+    uint16_t *fb;
+    int pen;
+    int touch_type, touch_x, touch_y;
+    int delay_us;            // Time taken by each command
+    int late_us;             // Extra time taken by the next command only
+    int nak;                 // Commands to NAK instead of running
+    int paused;              // Stops reading the link, like a hung panel
+    fake_cmd cmds[FAKE_MAX_CMDS];
+    int count;
+    long bytes;
+    pthread_t thread;
+    pthread_mutex_t lock;
+} fake_panel;
+
+fake_panel* fake_panel_open(int w, int h);
+void fake_panel_close(fake_panel *p);
+void fake_panel_reset(fake_panel *p);
+int fake_panel_count(fake_panel *p, int op);
+const fake_cmd* fake_panel_find(fake_panel *p, int op, int nth);
+uint16_t fake_panel_pixel(fake_panel *p, int x, int y);
+void fake_panel_touch(fake_panel *p, int type, int x, int y);
+
+// Big-endian word at offset of a logged command
+int fake_word(const fake_cmd *c, int offset);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,266 @@
+#include "test.h"
+#include "ulcd_batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define W 64
+#define H 48
+
+static void test_clipping() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_batch *b = ulcd_batch_create(&p->dev);
+
+    // A solid rectangle is clipped to the screen
+    ulcd_batch_rect(b, -5, -5, 9, 100, 0xF800);
+    CHECK(ulcd_batch_flush(b));
+    const fake_cmd *c = fake_panel_find(p, 0x72, 0);
+    CHECK(c != 0);
+    if(c) {
+        CHECK(fake_word(c, 1) == 0 && fake_word(c, 3) == 0);
+        CHECK(fake_word(c, 5) == 9 && fake_word(c, 7) == H - 1);
+    }
+
+    // A clipped outline is drawn as the visible parts of its edges
+    fake_panel_reset(p);
+    ulcd_batch_pen_style(b, ULCD_PEN_WIREFRAME);
+    ulcd_batch_rect(b, -5, 10, 20, 20, 0x001F);
+    CHECK(ulcd_batch_flush(b));
+    CHECK(fake_panel_count(p, 0x72) == 0);
+    CHECK(fake_panel_count(p, 0x4C) == 3);
+
+    // Lines are clipped to the screen edges
+    fake_panel_reset(p);
+    ulcd_batch_line(b, -10, 5, W + 10, 5, 0x07E0);
+    CHECK(ulcd_batch_flush(b));
+    c = fake_panel_find(p, 0x4C, 0);
+    CHECK(c != 0);
+    if(c) {
+        CHECK(fake_word(c, 1) == 0 && fake_word(c, 5) == W - 1);
+        CHECK(fake_word(c, 3) == 5 && fake_word(c, 7) == 5);
+    }
+
+    ulcd_batch_free(b);
+    fake_panel_close(p);
+}
+
+static void test_culling() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_batch *b = ulcd_batch_create(&p->dev);
+    ulcd_batch_stats s;
+
+    ulcd_batch_pixel(b, W, 5, 1);
+    ulcd_batch_pixel(b, -1, 5, 1);
+    ulcd_batch_rect(b, W + 1, 0, W + 10, 10, 1);
+    ulcd_batch_line(b, -10, -10, -1, -5, 1);
+    ulcd_batch_circle(b, 10, -20, 5, 1);
+    ulcd_batch_text(b, "off", 0, H, 0, 1);
+    ulcd_batch_pixel(b, W - 1, H - 1, 2);
+    CHECK(ulcd_batch_flush(b));
+
+    ulcd_batch_get_stats(b, &s);
+    CHECK(s.submitted == 7);
+    CHECK(s.culled == 6);
+    CHECK(s.sent == 1);
+    CHECK(p->count == 1 && p->cmds[0].op == 0x50);
+    CHECK(fake_panel_pixel(p, W - 1, H - 1) == 2);
+
+    ulcd_batch_free(b);
+    fake_panel_close(p);
+}
+
+static void test_overdraw() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_batch *b = ulcd_batch_create(&p->dev);
+    ulcd_batch_stats s;
+
+    // Hidden by the solid rectangle drawn after them
+    ulcd_batch_pixel(b, 5, 5, 1);
+    ulcd_batch_line(b, 2, 2, 8, 8, 1);
+    ulcd_batch_text(b, "a", 3, 3, 0, 1);
+    ulcd_batch_pen_style(b, ULCD_PEN_WIREFRAME);
+    ulcd_batch_rect(b, 1, 1, 9, 9, 1);
+
+    // An outline covers nothing
+    ulcd_batch_rect(b, 0, 0, 20, 20, 2);
+    ulcd_batch_pen_style(b, ULCD_PEN_SOLID);
+    ulcd_batch_rect(b, 0, 0, 10, 10, 3);
+
+    // Not completely covered
+    ulcd_batch_pixel(b, 24, 30, 4);
+    ulcd_batch_pixel(b, 30, 24, 4);
+    ulcd_batch_pixel(b, 41, 30, 4);
+    ulcd_batch_pixel(b, 30, 41, 4);
+    ulcd_batch_pixel(b, 30, 30, 4);
+    ulcd_batch_rect(b, 25, 25, 31, 31, 5);
+    ulcd_batch_rect(b, 26, 26, 40, 40, 6);
+    CHECK(ulcd_batch_flush(b));
+
+    ulcd_batch_get_stats(b, &s);
+    CHECK(s.overdrawn == 5);
+    CHECK(fake_panel_count(p, 0x50) == 4);
+    CHECK(fake_panel_count(p, 0x4C) == 0);
+    CHECK(fake_panel_count(p, 0x53) == 0);
+    CHECK(fake_panel_count(p, 0x72) == 4);
+    CHECK(fake_panel_pixel(p, 15, 0) == 2);
+    CHECK(fake_panel_pixel(p, 5, 5) == 3);
+    CHECK(fake_panel_pixel(p, 25, 25) == 5);
+    CHECK(fake_panel_pixel(p, 30, 30) == 6);
+
+    // A clear hides everything before it
+    fake_panel_reset(p);
+    ulcd_batch_rect(b, 0, 0, 10, 10, 7);
+    ulcd_batch_pixel(b, 1, 1, 7);
+    ulcd_batch_clear(b);
+    ulcd_batch_pixel(b, 2, 2, 8);
+    CHECK(ulcd_batch_flush(b));
+    CHECK(p->count == 2);
+    CHECK(p->cmds[0].op == 0x45 && p->cmds[1].op == 0x50);
+
+    ulcd_batch_free(b);
+    fake_panel_close(p);
+}
+
+static void test_merge() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_batch *b = ulcd_batch_create(&p->dev);
+    ulcd_batch_stats s;
+
+    // Side by side, then stacked on the result
+    ulcd_batch_rect(b, 0, 0, 9, 9, 0xF800);
+    ulcd_batch_rect(b, 10, 0, 19, 9, 0xF800);
+    ulcd_batch_rect(b, 20, 0, 29, 9, 0xF800);
+    ulcd_batch_rect(b, 0, 10, 29, 12, 0xF800);
+
+    // Different colour, not touching or not forming a rectangle
+    ulcd_batch_rect(b, 0, 20, 9, 29, 0x001F);
+    ulcd_batch_rect(b, 10, 20, 19, 29, 0x07E0);
+    ulcd_batch_rect(b, 30, 20, 39, 29, 0x07E0);
+    ulcd_batch_rect(b, 40, 21, 49, 29, 0x07E0);
+    CHECK(ulcd_batch_flush(b));
+
+    ulcd_batch_get_stats(b, &s);
+    CHECK(s.merged == 3);
+    CHECK(fake_panel_count(p, 0x72) == 5);
+    const fake_cmd *c = fake_panel_find(p, 0x72, 0);
+    if(c) {
+        CHECK(fake_word(c, 1) == 0 && fake_word(c, 3) == 0);
+        CHECK(fake_word(c, 5) == 29 && fake_word(c, 7) == 12);
+    }
+
+    ulcd_batch_free(b);
+    fake_panel_close(p);
+}
+
+static void test_pen_skipping() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_batch *b = ulcd_batch_create(&p->dev);
+    ulcd_batch_stats s;
+
+    // The panel's pen is unknown at first, so the first rectangle sets it.
+    // Changes without a shape in between, or to the current style, are skipped.
+    ulcd_batch_pen_style(b, ULCD_PEN_WIREFRAME);
+    ulcd_batch_pen_style(b, ULCD_PEN_SOLID);
+    ulcd_batch_rect(b, 0, 0, 4, 4, 1);
+    ulcd_batch_pen_style(b, ULCD_PEN_SOLID);
+    ulcd_batch_circle(b, 20, 20, 4, 1);
+    ulcd_batch_pen_style(b, ULCD_PEN_WIREFRAME);
+    ulcd_batch_pixel(b, 40, 40, 1);
+    ulcd_batch_pen_style(b, ULCD_PEN_SOLID);
+    ulcd_batch_rect(b, 30, 0, 34, 4, 1);
+    CHECK(ulcd_batch_flush(b));
+
+    ulcd_batch_get_stats(b, &s);
+    CHECK(fake_panel_count(p, 0x70) == 1);
+    CHECK(s.pen_changes == 1);
+    CHECK(s.pen_skipped == 4);
+
+    // Known pen carries over to the next flush
+    fake_panel_reset(p);
+    ulcd_batch_rect(b, 0, 0, 4, 4, 1);
+    CHECK(ulcd_batch_flush(b));
+    CHECK(fake_panel_count(p, 0x70) == 0);
+
+    ulcd_batch_free(b);
+    fake_panel_close(p);
+}
+
+// Reference drawing for the random scenes
+static uint16_t ref[W * H];
+
+static void ref_rect(int x0, int y0, int x1, int y1, int pen, uint16_t c) {
+    int x, y;
+    for(y = y0; y <= y1; y++) {
+        for(x = x0; x <= x1; x++) {
+            if(x < 0 || y < 0 || x >= W || y >= H) continue;
+            if(pen == ULCD_PEN_SOLID || x == x0 || x == x1 || y == y0 || y == y1) {
+                ref[y * W + x] = c;
+            }
+        }
+    }
+}
+
+// Optimising must never change what ends up on the screen.
+static void test_random_scenes() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_batch *b = ulcd_batch_create(&p->dev);
+    int scene, i, bad = 0;
+    srand(1234);
+    for(scene = 0; scene < 200 && !bad; scene++) {
+        memcpy(ref, p->fb, sizeof(ref));
+        for(i = 0; i < 30; i++) {
+            int kind = rand() % 10;
+            uint16_t c = 1 + rand() % 3;
+            int x0 = rand() % (W + 20) - 10, y0 = rand() % (H + 20) - 10;
+            int x1 = x0 + rand() % 24, y1 = y0 + rand() % 24;
+            if(kind == 0) {
+                ulcd_batch_clear(b);
+                memset(ref, 0, sizeof(ref));
+            } else if(kind < 4) {
+                ulcd_batch_pixel(b, x0, y0, c);
+                if(x0 >= 0 && y0 >= 0 && x0 < W && y0 < H) ref[y0 * W + x0] = c;
+            } else if(kind < 6) {
+                // Outlines on screen only, clipped ones become lines
+                if(x0 < 0) x0 = 0;
+                if(y0 < 0) y0 = 0;
+                if(x1 >= W) x1 = W - 1;
+                if(y1 >= H) y1 = H - 1;
+                if(x0 > x1 || y0 > y1) continue;
+                ulcd_batch_pen_style(b, ULCD_PEN_WIREFRAME);
+                ulcd_batch_rect(b, x0, y0, x1, y1, c);
+                ulcd_batch_pen_style(b, ULCD_PEN_SOLID);
+                ref_rect(x0, y0, x1, y1, ULCD_PEN_WIREFRAME, c);
+            } else {
+                // Mostly aligned to a grid so that merges happen
+                if(kind < 9) {
+                    x0 &= ~7;
+                    y0 &= ~7;
+                    x1 = x0 + 7 + (rand() % 2) * 8;
+                    y1 = y0 + 7;
+                }
+                ulcd_batch_rect(b, x0, y0, x1, y1, c);
+                ref_rect(x0, y0, x1, y1, ULCD_PEN_SOLID, c);
+            }
+        }
+        CHECK(ulcd_batch_flush(b));
+        bad = memcmp(ref, p->fb, sizeof(ref)) != 0;
+    }
+    CHECK(!bad);
+
+    ulcd_batch_stats s;
+    ulcd_batch_get_stats(b, &s);
+    CHECK(s.merged > 0 && s.overdrawn > 0 && s.culled > 0);
+
+    ulcd_batch_free(b);
+    fake_panel_close(p);
+}
+
+int main() {
+    test_clipping();
+    test_culling();
+    test_overdraw();
+    test_merge();
+    test_pen_skipping();
+    test_random_scenes();
+    return test_result("test_batch");
+}
@@ -0,0 +1,76 @@
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Source framebuffer, wider than the rectangles sent from it
+#define SRC_W 2200
+#define SRC_H 80
+#define STRIDE (SRC_W * 2 + 6)
+
+static char *src;
+
+// Stores pixel values in the source, big-endian or little-endian.
+static void fill(int little) {
+    int x, y;
+    for(y = 0; y < SRC_H; y++) {
+        for(x = 0; x < SRC_W; x++) {
+            uint16_t c = (uint16_t)(x * 3 + y * 1021 + 1);
+            char *px = src + y * STRIDE + x * 2;
+            px[little ? 1 : 0] = c >> 8;
+            px[little ? 0 : 1] = c & 0xFF;
+        }
+    }
+}
+
+static int shows(fake_panel *p, int x, int y, int sx, int sy, int w, int h) {
+    int i, j;
+    for(j = 0; j < h; j++) {
+        for(i = 0; i < w; i++) {
+            if(fake_panel_pixel(p, x + i, y + j) != (uint16_t)((sx + i) * 3 + (sy + j) * 1021 + 1)) return 0;
+        }
+    }
+    return 1;
+}
+
+static void check_rect(fake_panel *p, int flags, int x, int y, int sx, int sy, int w, int h) {
+    fill(flags & ULCD_BLIT_SWAP);
+    fake_panel_reset(p);
+    CHECK(ulcd_blit_rect(&p->dev, x, y, src, STRIDE, sx, sy, w, h, flags));
+    CHECK(fake_panel_count(p, 0x49) == 1);
+    const fake_cmd *c = fake_panel_find(p, 0x49, 0);
+    CHECK(c && c->len == 10 + w * h * 2);
+    CHECK(c && fake_word(c, 1) == x && fake_word(c, 3) == y
+            && fake_word(c, 5) == w && fake_word(c, 7) == h);
+    CHECK(shows(p, x, y, sx, sy, w, h));
+}
+
+static void test_blit_rect() {
+    fake_panel *p = fake_panel_open(SRC_W, SRC_H);
+    int flags;
+    for(flags = 0; flags <= ULCD_BLIT_SWAP; flags += ULCD_BLIT_SWAP) {
+        // A few short rows
+        check_rect(p, flags, 3, 4, 17, 9, 20, 5);
+
+        // Rows wider than the bounce buffer
+        check_rect(p, flags, 0, 0, 50, 2, 2100, 3);
+        check_rect(p, flags, 1, 10, 0, 0, 2049, 2);
+
+        // More rows than one writev takes
+        check_rect(p, flags, 30, 1, 100, 5, 7, 70);
+        check_rect(p, flags, 0, 0, 0, 0, 64, 65);
+    }
+
+    // Nothing to send
+    fake_panel_reset(p);
+    CHECK(ulcd_blit_rect(&p->dev, 0, 0, src, STRIDE, 0, 0, 0, 10, 0));
+    CHECK(p->count == 0);
+    fake_panel_close(p);
+}
+
+int main() {
+    src = (char*)malloc(STRIDE * SRC_H);
+    test_blit_rect();
+    free(src);
+    return test_result("test_blit");
+}
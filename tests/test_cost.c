@@ -0,0 +1,114 @@
+#include "test.h"
+#include "ulcd_cost.h"
+
+#include <string.h>
+#include <unistd.h>
+
+static char path[64];
+
+static void make_model(fake_panel *p, ulcd_cost_model *m) {
+    int i;
+    memset(m, 0, sizeof(*m));
+    m->type = p->dev.type;
+    m->hw_ver = p->dev.hw_ver;
+    m->sw_ver = p->dev.sw_ver;
+    m->w = p->dev.w;
+    m->h = p->dev.h;
+    strcpy(m->link, "unknown");
+    m->rtt_ms = 12.5;
+    m->byte_ms = 0.086806;
+    for(i = 0; i < ULCD_OP_COUNT; i++) {
+        m->ops[i].base_ms = 0.25 * i;
+        m->ops[i].unit_ms = 0.001 * (i + 1);
+    }
+}
+
+static int same_costs(const ulcd_cost_model *a, const ulcd_cost_model *b) {
+    int i;
+    if(a->byte_ms != b->byte_ms) return 0;
+    for(i = 0; i < ULCD_OP_COUNT; i++) {
+        if(a->ops[i].base_ms != b->ops[i].base_ms || a->ops[i].unit_ms != b->ops[i].unit_ms) return 0;
+    }
+    return 1;
+}
+
+// A saved model loads back for the same panel and link, with the round trip
+// measured again. Models of other panels in the file are kept.
+static void test_round_trip() {
+    fake_panel *p = fake_panel_open(64, 48);
+    ulcd_cost_model m, other, got;
+    make_model(p, &m);
+    other = m;
+    other.w = 320;
+    other.h = 240;
+    other.rtt_ms = 99;
+
+    unlink(path);
+    CHECK(!ulcd_cost_load(&p->dev, path, &got));
+    CHECK(ulcd_cost_save(&other, path));
+    CHECK(!ulcd_cost_load(&p->dev, path, &got));
+    CHECK(strstr(ulcd_get_error_str(), "No cost model") != 0);
+
+    CHECK(ulcd_cost_save(&m, path));
+    fake_panel_reset(p);
+    CHECK(ulcd_cost_load(&p->dev, path, &got));
+    CHECK(got.type == m.type && got.w == 64 && got.h == 48 && got.baud == m.baud);
+    CHECK(strcmp(got.link, "unknown") == 0);
+    CHECK(same_costs(&got, &m));
+    CHECK(got.rtt_ms >= 0 && got.rtt_ms < 12.5);
+    CHECK(fake_panel_count(p, 0x55) == 3);
+
+    // Saving again replaces the panel's line and leaves the other alone
+    m.ops[ULCD_OP_BLIT].unit_ms = 0.5;
+    CHECK(ulcd_cost_save(&m, path));
+    CHECK(ulcd_cost_load(&p->dev, path, &got));
+    CHECK(got.ops[ULCD_OP_BLIT].unit_ms == 0.5);
+    char line[1024];
+    int lines = 0;
+    FILE *f = fopen(path, "r");
+    while(f && fgets(line, sizeof(line), f)) lines++;
+    if(f) fclose(f);
+    CHECK(lines == 2);
+
+    // Lines that don't parse are kept but never loaded
+    f = fopen(path, "a");
+    fputs("ulcd-cost-1 0 0 0 64 48\n", f);
+    fclose(f);
+    CHECK(ulcd_cost_save(&m, path));
+    CHECK(ulcd_cost_load(&p->dev, path, &got));
+    lines = 0;
+    f = fopen(path, "r");
+    while(f && fgets(line, sizeof(line), f)) lines++;
+    if(f) fclose(f);
+    CHECK(lines == 3);
+
+    fake_panel_close(p);
+}
+
+// Gaps are merged while sending them is cheaper than another blit.
+static void test_merge_bytes() {
+    ulcd_cost_model m;
+    memset(&m, 0, sizeof(m));
+    CHECK(ulcd_cost_merge_bytes(&m) == 0);
+
+    m.rtt_ms = 10;
+    m.byte_ms = 0.1;
+    int fast = ulcd_cost_merge_bytes(&m);
+    CHECK(fast == 110);
+
+    // A slow link round trip or blit setup is worth more bytes
+    m.ops[ULCD_OP_BLIT].base_ms = 10;
+    CHECK(ulcd_cost_merge_bytes(&m) == 210);
+
+    // Pixels the panel is slow to draw are worth fewer
+    m.ops[ULCD_OP_BLIT].unit_ms = 0.2;
+    CHECK(ulcd_cost_merge_bytes(&m) == 105);
+}
+
+int main() {
+    sprintf(path, "/tmp/ulcd-test-%d.cost", (int)getpid());
+    test_round_trip();
+    test_merge_bytes();
+    unlink(path);
+    return test_result("test_cost");
+}
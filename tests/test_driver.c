@@ -0,0 +1,101 @@
+#define _XOPEN_SOURCE 600
+#include "test.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void set_late(fake_panel *p, int late_us) {
+    pthread_mutex_lock(&p->lock);
+    p->late_us = late_us;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void set_nak(fake_panel *p, int nak) {
+    pthread_mutex_lock(&p->lock);
+    p->nak = nak;
+    pthread_mutex_unlock(&p->lock);
+}
+
+// A NAK fails the command without a resync, retries run it again.
+static void test_nak() {
+    fake_panel *p = fake_panel_open(64, 48);
+
+    set_nak(p, 1);
+    CHECK(!ulcd_clear(&p->dev));
+    CHECK(strstr(ulcd_get_error_str(), "NAK") != 0);
+    CHECK(fake_panel_count(p, 0x55) == 0);
+
+    ulcd_set_timeout(&p->dev, 500, 2);
+    set_nak(p, 2);
+    CHECK(ulcd_draw_pixel(&p->dev, 3, 4, 0x1234));
+    CHECK(fake_panel_count(p, 0x50) == 3);
+    CHECK(fake_panel_pixel(p, 3, 4) == 0x1234);
+
+    set_nak(p, 3);
+    CHECK(!ulcd_draw_pixel(&p->dev, 5, 6, 0x4321));
+    CHECK(fake_panel_count(p, 0x50) == 6);
+    CHECK(fake_panel_pixel(p, 5, 6) == 0);
+
+    fake_panel_close(p);
+}
+
+// A reply that comes too late is drained by the resync, so it is not taken
+// for the next command's.
+static void test_timeout() {
+    fake_panel *p = fake_panel_open(64, 48);
+    ulcd_set_timeout(&p->dev, 50, 0);
+    fake_panel_touch(p, ULCD_TOUCH_PRESS, 7, 9);
+
+    set_late(p, 150000);
+    CHECK(!ulcd_clear(&p->dev));
+    CHECK(strstr(ulcd_get_error_str(), "timeout") != 0);
+    CHECK(fake_panel_count(p, 0x55) >= 1);
+    CHECK(p->dev.pen == -1);
+
+    CHECK(ulcd_draw_pixel(&p->dev, 1, 1, 0xFFFF));
+    ulcd_event ev;
+    ulcd_get_event(&p->dev, &ev);
+    CHECK(ev.type == ULCD_TOUCH_PRESS && ev.x == 7 && ev.y == 9);
+
+    // Same for a word reply
+    set_late(p, 150000);
+    ulcd_get_event(&p->dev, &ev);
+    CHECK(ev.type == ULCD_NO_ACTIVITY);
+    ulcd_get_event(&p->dev, &ev);
+    CHECK(ev.type == ULCD_TOUCH_PRESS && ev.x == 7 && ev.y == 9);
+
+    fake_panel_close(p);
+}
+
+static int open_fds() {
+    DIR *d = opendir("/proc/self/fd");
+    int n = 0;
+    while(readdir(d)) n++;
+    closedir(d);
+    return n;
+}
+
+// A silent panel makes init fail without leaking the port.
+static void test_init_silent() {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(master >= 0);
+    if(master < 0) return;
+    grantpt(master);
+    unlockpt(master);
+
+    int before = open_fds();
+    CHECK(ulcd_init(ptsname(master)) == 0);
+    CHECK(strstr(ulcd_get_error_str(), "initialization") != 0);
+    CHECK(open_fds() == before);
+    close(master);
+}
+
+int main() {
+    test_nak();
+    test_timeout();
+    test_init_silent();
+    return test_result("test_driver");
+}
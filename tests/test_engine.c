@@ -0,0 +1,107 @@
+#include "test.h"
+#include "ulcd_engine.h"
+
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    int done, ok, len;
+    char reply[8];
+} result;
+
+static void on_done(ulcd_dev *dev, int ok, const char *reply, int reply_len, void *userdata) {
+    result *r = (result*)userdata;
+    (void)dev;
+    r->done = 1;
+    r->ok = ok;
+    r->len = reply_len;
+    memcpy(r->reply, reply, reply_len < 8 ? reply_len : 8);
+}
+
+static int run_until(ulcd_engine *eng, result *r) {
+    int i;
+    for(i = 0; i < 200 && !r->done; i++) {
+        ulcd_engine_run(eng, 10);
+    }
+    return r->done;
+}
+
+static void test_pipeline() {
+    fake_panel *p = fake_panel_open(64, 48);
+    ulcd_engine *eng = ulcd_engine_create();
+    CHECK(ulcd_engine_add(eng, &p->dev));
+    CHECK(ulcd_engine_set_pipeline(eng, 4));
+
+    result r[6];
+    memset(r, 0, sizeof(r));
+    static const char clear = 0x45, touch[2] = { 0x6F, 0x04 };
+    int i;
+    for(i = 0; i < 5; i++) {
+        CHECK(ulcd_engine_submit(eng, &p->dev, &clear, 1, 1, on_done, &r[i]));
+    }
+    fake_panel_touch(p, ULCD_TOUCH_MOVING, 0, 0);
+    CHECK(ulcd_engine_submit(eng, &p->dev, touch, 2, 4, on_done, &r[5]));
+    CHECK(run_until(eng, &r[5]));
+    for(i = 0; i < 5; i++) {
+        CHECK(r[i].done && r[i].ok);
+    }
+    CHECK(r[5].ok && r[5].len == 4 && r[5].reply[1] == ULCD_TOUCH_MOVING);
+    CHECK(ulcd_engine_pending(eng, &p->dev) == 0);
+
+    // A NAK fails only its own command
+    pthread_mutex_lock(&p->lock);
+    p->nak = 1;
+    pthread_mutex_unlock(&p->lock);
+    memset(r, 0, sizeof(r));
+    CHECK(ulcd_engine_submit(eng, &p->dev, &clear, 1, 1, on_done, &r[0]));
+    CHECK(ulcd_engine_submit(eng, &p->dev, &clear, 1, 1, on_done, &r[1]));
+    CHECK(run_until(eng, &r[1]));
+    CHECK(r[0].done && !r[0].ok);
+    CHECK(r[1].ok);
+
+    ulcd_engine_free(eng);
+    fake_panel_close(p);
+}
+
+// A reply that arrives after its command timed out must not be taken for
+// the next command's.
+static void test_late_reply() {
+    fake_panel *p = fake_panel_open(64, 48);
+    p->dev.timeout = 50;
+    p->delay_us = 150000;
+    fake_panel_touch(p, ULCD_TOUCH_MOVING, 0, 0);
+    ulcd_engine *eng = ulcd_engine_create();
+    CHECK(ulcd_engine_add(eng, &p->dev));
+
+    result a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    static const char clear = 0x45, touch[2] = { 0x6F, 0x04 };
+    CHECK(ulcd_engine_submit(eng, &p->dev, &clear, 1, 1, on_done, &a));
+    CHECK(run_until(eng, &a));
+    CHECK(!a.ok);
+
+    // Waits for the panel to finish the slow command and send its ACK
+    pthread_mutex_lock(&p->lock);
+    p->delay_us = 0;
+    pthread_mutex_unlock(&p->lock);
+
+    CHECK(ulcd_engine_submit(eng, &p->dev, touch, 2, 4, on_done, &b));
+    CHECK(run_until(eng, &b));
+    CHECK(b.ok && b.len == 4);
+    CHECK(b.reply[0] == 0 && b.reply[1] == ULCD_TOUCH_MOVING && b.reply[2] == 0 && b.reply[3] == 0);
+
+    // The link was resynced before the next command went out
+    pthread_mutex_lock(&p->lock);
+    CHECK(p->count == 3 && p->cmds[1].op == 0x55 && p->cmds[2].op == 0x6F);
+    pthread_mutex_unlock(&p->lock);
+
+    ulcd_engine_free(eng);
+    fake_panel_close(p);
+}
+
+int main() {
+    test_pipeline();
+    test_late_reply();
+    return test_result("test_engine");
+}
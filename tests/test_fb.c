@@ -0,0 +1,220 @@
+#include "test.h"
+#include "ulcd_fb.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define W 64
+#define H 48
+
+static char path[64];
+static ulcd_fb_server *server;
+static volatile int running, paused;
+
+static void* server_main(void *arg) {
+    (void)arg;
+    while(running) {
+        if(paused) {
+            usleep(1000);
+            continue;
+        }
+        CHECK(ulcd_fb_server_run(server, 10));
+    }
+    return 0;
+}
+
+static pthread_t start_server() {
+    pthread_t t;
+    running = 1;
+    paused = 0;
+    pthread_create(&t, 0, server_main, 0);
+    return t;
+}
+
+static void stop_server(pthread_t t) {
+    running = 0;
+    pthread_join(t, 0);
+}
+
+static void* resume_later(void *arg) {
+    (void)arg;
+    usleep(100000);
+    paused = 0;
+    return 0;
+}
+
+// Everything damaged and synced is on the panel.
+static int panel_matches(fake_panel *p, ulcd_fb_client *c) {
+    int x, y;
+    for(y = 0; y < H; y++) {
+        for(x = 0; x < W; x++) {
+            if(fake_panel_pixel(p, x, y) != c->pixels[y * (c->stride / 2) + x]) return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_damage() {
+    fake_panel *p = fake_panel_open(W, H);
+    server = ulcd_fb_server_create(&p->dev, path);
+    CHECK(server != 0);
+    if(!server) return;
+    pthread_t t = start_server();
+
+    ulcd_fb_client *a = ulcd_fb_connect(path);
+    ulcd_fb_client *b = ulcd_fb_connect(path);
+    CHECK(a && b);
+    if(!a || !b) return;
+    CHECK(a->w == W && a->h == H && a->stride >= W * 2);
+
+    // Both clients see the same framebuffer. a draws inside the two
+    // overlapping rectangles it damages below.
+    int x, y;
+    for(y = 10; y < 22; y++) {
+        for(x = 10; x < 45; x++) {
+            if((x < 30 && y < 15) || (x >= 15 && y >= 12)) {
+                a->pixels[y * (a->stride / 2) + x] = 0xF800 + x + y;
+            }
+        }
+    }
+    CHECK(b->pixels[15 * (b->stride / 2) + 20] == 0xF800 + 35);
+    b->pixels[40 * (b->stride / 2) + 60] = 0x1234;
+
+    // Overlapping and off-screen damage
+    fake_panel_reset(p);
+    CHECK(ulcd_fb_damage(a, 10, 10, 20, 5));
+    CHECK(ulcd_fb_damage(a, 15, 12, 30, 10));
+    CHECK(ulcd_fb_damage(a, -10, -10, 5, 5));
+    CHECK(ulcd_fb_damage(b, 60, 40, 10, 10));
+    CHECK(ulcd_fb_sync(a, 2000));
+    CHECK(ulcd_fb_sync(b, 2000));
+    CHECK(panel_matches(p, a));
+    CHECK(fake_panel_count(p, 0x49) >= 1 && fake_panel_count(p, 0x49) <= 3);
+    CHECK(fake_panel_count(p, 0x45) == 0);
+
+    // Damage is not lost while the server is busy: sends block until it
+    // catches up.
+    pthread_t r;
+    paused = 1;
+    pthread_create(&r, 0, resume_later, 0);
+    int i, ok = 1;
+    for(i = 0; i < 2000; i++) {
+        a->pixels[(i % H) * (a->stride / 2) + i % W] = i;
+        ok &= ulcd_fb_damage(a, i % W, i % H, 1, 1);
+    }
+    CHECK(ok);
+    CHECK(ulcd_fb_sync(a, 2000));
+    CHECK(panel_matches(p, a));
+    pthread_join(r, 0);
+
+    // Touch events go to every client
+    fake_panel_touch(p, ULCD_TOUCH_PRESS, 5, 6);
+    ulcd_event ev;
+    CHECK(ulcd_fb_wait_event(a, &ev, 2000));
+    CHECK(ev.type == ULCD_TOUCH_PRESS && ev.x == 5 && ev.y == 6);
+    CHECK(ulcd_fb_wait_event(b, &ev, 2000));
+    CHECK(ev.type == ULCD_TOUCH_PRESS);
+    fake_panel_touch(p, ULCD_NO_ACTIVITY, 0, 0);
+
+    stop_server(t);
+    ulcd_fb_stats stats;
+    ulcd_fb_server_get_stats(server, &stats);
+    CHECK(stats.damage_msgs == 2004);
+    CHECK(stats.errors == 0);
+
+    ulcd_fb_disconnect(a);
+    ulcd_fb_disconnect(b);
+    ulcd_fb_server_free(server);
+    CHECK(access(path, F_OK) != 0);
+    fake_panel_close(p);
+}
+
+static int damage_rows(ulcd_fb_client *c, int y0, int y1) {
+    return ulcd_fb_damage(c, 0, y0, W, 1) && ulcd_fb_damage(c, 0, y1, W, 1)
+        && ulcd_fb_sync(c, 2000);
+}
+
+// Damaged rows far apart are merged when the cost model says a blit costs
+// more than the rows between them.
+static void test_cost_merge() {
+    fake_panel *p = fake_panel_open(W, H);
+    server = ulcd_fb_server_create(&p->dev, path);
+    CHECK(server != 0);
+    if(!server) return;
+    pthread_t t = start_server();
+    ulcd_fb_client *c = ulcd_fb_connect(path);
+    CHECK(c != 0);
+    if(!c) return;
+
+    fake_panel_reset(p);
+    CHECK(damage_rows(c, 0, 40));
+    CHECK(fake_panel_count(p, 0x49) == 2);
+
+    ulcd_cost_model m;
+    memset(&m, 0, sizeof(m));
+    m.rtt_ms = 1000;
+    m.byte_ms = 0.1;
+    stop_server(t);
+    ulcd_fb_server_set_cost_model(server, &m);
+    t = start_server();
+    fake_panel_reset(p);
+    CHECK(damage_rows(c, 0, 40));
+    CHECK(fake_panel_count(p, 0x49) == 1);
+    const fake_cmd *b = fake_panel_find(p, 0x49, 0);
+    CHECK(b && fake_word(b, 7) == 41);
+
+    // Back to the default
+    stop_server(t);
+    ulcd_fb_server_set_cost_model(server, 0);
+    t = start_server();
+    fake_panel_reset(p);
+    CHECK(damage_rows(c, 0, 40));
+    CHECK(fake_panel_count(p, 0x49) == 2);
+
+    stop_server(t);
+    ulcd_fb_disconnect(c);
+    ulcd_fb_server_free(server);
+    fake_panel_close(p);
+}
+
+// Only a stale socket at the path is replaced.
+static void test_socket_path() {
+    fake_panel *p = fake_panel_open(W, H);
+
+    FILE *f = fopen(path, "w");
+    CHECK(f != 0);
+    if(f) fclose(f);
+    CHECK(ulcd_fb_server_create(&p->dev, path) == 0);
+    CHECK(access(path, F_OK) == 0);
+    unlink(path);
+
+    // Left behind by a server that died
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    CHECK(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    close(fd);
+    ulcd_fb_server *s = ulcd_fb_server_create(&p->dev, path);
+    CHECK(s != 0);
+
+    // Another server is running there
+    CHECK(ulcd_fb_server_create(&p->dev, path) == 0);
+    CHECK(access(path, F_OK) == 0);
+
+    ulcd_fb_server_free(s);
+    fake_panel_close(p);
+}
+
+int main() {
+    sprintf(path, "/tmp/ulcd-test-%d.sock", (int)getpid());
+    test_damage();
+    test_cost_merge();
+    test_socket_path();
+    unlink(path);
+    return test_result("test_fb");
+}
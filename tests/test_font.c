@@ -0,0 +1,136 @@
+#include "test.h"
+#include "ulcd_font.h"
+
+#include <string.h>
+#include <unistd.h>
+
+static char path[64];
+
+// Two glyphs: 'A' a 4x3 box with a gap, 'i' a one pixel wide line below
+// the baseline.
+static const char *good =
+    "STARTFONT 2.1\n"
+    "FONT_ASCENT 4\n"
+    "FONT_DESCENT 1\n"
+    "STARTCHAR A\n"
+    "ENCODING 65\n"
+    "DWIDTH 5 0\n"
+    "BBX 4 3 0 0\n"
+    "BITMAP\n"
+    "F0\n"
+    "90\n"
+    "F0\n"
+    "ENDCHAR\n"
+    "STARTCHAR i\n"
+    "ENCODING 105\n"
+    "DWIDTH 2 0\n"
+    "BBX 1 2 0 -1\n"
+    "BITMAP\n"
+    "80\n"
+    "80\n"
+    "ENDCHAR\n"
+    "STARTCHAR big\n"
+    "ENCODING 300\n"
+    "BBX 100000 100000 0 0\n"
+    "BITMAP\n"
+    "ENDCHAR\n"
+    "ENDFONT\n";
+
+static ulcd_font* load(const char *text) {
+    FILE *f = fopen(path, "w");
+    fputs(text, f);
+    fclose(f);
+    return ulcd_font_load_bdf(path);
+}
+
+static void test_load() {
+    ulcd_font *font = load(good);
+    CHECK(font != 0);
+    if(!font) return;
+    CHECK(font->ascent == 4 && font->descent == 1);
+
+    ulcd_glyph *a = &font->glyphs['A'];
+    CHECK(a->w == 4 && a->h == 3 && a->advance == 5);
+    CHECK(a->bits && a->bits[0] == 0xF0 && a->bits[1] == 0x90 && a->bits[2] == 0xF0);
+    CHECK(font->glyphs['i'].yoff == -1);
+    CHECK(font->glyphs['B'].bits == 0);
+
+    CHECK(ulcd_font_text_width(font, "AiA") == 12);
+    ulcd_font_set_kerning(font, 'A', 'i', -1);
+    CHECK(ulcd_font_text_width(font, "AiA") == 11);
+    CHECK(ulcd_font_text_width(font, "AxA") == 10);
+    ulcd_font_free(font);
+}
+
+// Sizes that would overflow the glyph or cell buffers are rejected.
+static void test_bad_sizes() {
+    static const char *bad[] = {
+        "STARTCHAR x\nENCODING 65\nBBX 2147483647 2 0 0\nBITMAP\n00\nENDCHAR\n",
+        "STARTCHAR x\nENCODING 65\nBBX 65536 65536 0 0\nBITMAP\n00\nENDCHAR\n",
+        "STARTCHAR x\nENCODING 65\nBBX -8 2 0 0\nBITMAP\n00\nENDCHAR\n",
+        "STARTCHAR x\nENCODING 65\nDWIDTH 2000000000 0\nBBX 8 8 0 0\nBITMAP\n00\nENDCHAR\n",
+        "STARTCHAR x\nENCODING 65\nDWIDTH -5 0\nBBX 8 8 0 0\nBITMAP\n00\nENDCHAR\n",
+        "STARTCHAR x\nENCODING 65\nBBX 8 8 0 -2000000000\nBITMAP\n00\nENDCHAR\n",
+        "FONT_ASCENT 2000000000\nFONT_DESCENT 2000000000\n"
+        "STARTCHAR x\nENCODING 65\nBBX 8 8 0 0\nBITMAP\n00\nENDCHAR\n",
+        "STARTCHAR x\nENCODING 66\nENDCHAR\n",
+    };
+    int i;
+    for(i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++) {
+        ulcd_font *font = load(bad[i]);
+        CHECK(font == 0);
+        ulcd_font_free(font);
+    }
+
+    // More bitmap rows than the glyph has are ignored
+    ulcd_font *font = load("STARTCHAR x\nENCODING 65\nBBX 8 1 0 0\nBITMAP\nFF\nFF\nFF\nENDCHAR\n");
+    CHECK(font && font->glyphs['A'].bits[0] == 0xFF);
+    ulcd_font_free(font);
+}
+
+// Glyphs are drawn as advance x height cells in the atlas colours.
+static void test_atlas() {
+    ulcd_font *font = load(good);
+    if(!font) return;
+    fake_panel *p = fake_panel_open(64, 48);
+    ulcd_font_atlas *at = ulcd_font_atlas_create(&p->dev, font, 1, 0xFFFF, 0x001F);
+    CHECK(at != 0);
+    if(!at) return;
+
+    CHECK(ulcd_font_draw(at, "Ai?", 10, 20));
+    CHECK(fake_panel_count(p, 0x49) == 2);
+    const fake_cmd *c = fake_panel_find(p, 0x49, 0);
+    CHECK(c && fake_word(c, 5) == 5 && fake_word(c, 7) == 5);
+
+    // 'A' sits on the baseline, one row below the top
+    static const char *a_cell[5] = { ".....", "####.", "#..#.", "####.", "....." };
+    int x, y;
+    for(y = 0; y < 5; y++) {
+        for(x = 0; x < 5; x++) {
+            CHECK(fake_panel_pixel(p, 10 + x, 20 + y) == (a_cell[y][x] == '#' ? 0xFFFF : 0x001F));
+        }
+    }
+    // 'i' drops below it
+    CHECK(fake_panel_pixel(p, 15, 22) == 0x001F);
+    CHECK(fake_panel_pixel(p, 15, 23) == 0xFFFF);
+    CHECK(fake_panel_pixel(p, 15, 24) == 0xFFFF);
+    CHECK(fake_panel_pixel(p, 16, 23) == 0x001F);
+
+    // Off-screen glyphs are skipped
+    fake_panel_reset(p);
+    CHECK(ulcd_font_draw(at, "AA", 56, 0));
+    CHECK(fake_panel_count(p, 0x49) == 1);
+
+    ulcd_font_atlas_free(at);
+    ulcd_font_free(font);
+    fake_panel_close(p);
+}
+
+int main() {
+    sprintf(path, "/tmp/ulcd-test-%d.bdf", (int)getpid());
+    test_load();
+    test_bad_sizes();
+    test_atlas();
+    unlink(path);
+    return test_result("test_font");
+}
@@ -0,0 +1,123 @@
+#include "test.h"
+#include "ulcd_group.h"
+
+#include <sys/socket.h>
+
+#define N 3
+#define W 64
+#define H 48
+
+static char image[2][W * H * 2];
+
+static void make_images() {
+    int i, x, y;
+    for(i = 0; i < 2; i++) {
+        for(y = 0; y < H; y++) {
+            for(x = 0; x < W; x++) {
+                int c = 0x0841 + x * 7 + y * 131 + i * 5000;
+                image[i][(y * W + x) * 2] = c >> 8;
+                image[i][(y * W + x) * 2 + 1] = c & 0xFF;
+            }
+        }
+    }
+}
+
+static int shows(fake_panel *p, const char *data) {
+    const unsigned char *d = (const unsigned char*)data;
+    int i;
+    for(i = 0; i < W * H; i++) {
+        if(fake_panel_pixel(p, i % W, i / W) != ((d[i * 2] << 8) | d[i * 2 + 1])) return 0;
+    }
+    return 1;
+}
+
+static void set_paused(fake_panel *p, int paused) {
+    pthread_mutex_lock(&p->lock);
+    p->paused = paused;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static ulcd_group* open_group(fake_panel **p) {
+    ulcd_dev *devs[N];
+    int i;
+    for(i = 0; i < N; i++) {
+        p[i] = fake_panel_open(W, H);
+        devs[i] = &p[i]->dev;
+    }
+    return ulcd_group_create(devs, N);
+}
+
+static void close_group(ulcd_group *g, fake_panel **p) {
+    int i;
+    ulcd_group_free(g);
+    for(i = 0; i < N; i++) {
+        fake_panel_close(p[i]);
+    }
+}
+
+static void test_broadcast() {
+    fake_panel *p[N];
+    ulcd_group *g = open_group(p);
+    CHECK(ulcd_group_size(g) == N);
+
+    CHECK(ulcd_group_blit(g, 0, 0, W, H, image[0]) == N);
+    int i;
+    for(i = 0; i < N; i++) {
+        CHECK(ulcd_group_status(g, i) == ULCD_GROUP_OK);
+        CHECK(shows(p[i], image[0]));
+    }
+
+    // A NAK only fails its own member
+    pthread_mutex_lock(&p[1]->lock);
+    p[1]->nak = 1;
+    pthread_mutex_unlock(&p[1]->lock);
+    CHECK(ulcd_group_clear(g) == N - 1);
+    CHECK(ulcd_group_status(g, 0) == ULCD_GROUP_OK);
+    CHECK(ulcd_group_status(g, 1) == ULCD_GROUP_NAK);
+    CHECK(fake_panel_pixel(p[0], 5, 5) == 0);
+    CHECK(shows(p[1], image[0]));
+
+    close_group(g, p);
+}
+
+// A panel that hangs in the middle of a blit is brought back in sync
+// before it gets another command.
+static void test_hung_member() {
+    fake_panel *p[N];
+    ulcd_group *g = open_group(p);
+    ulcd_group_set_timeout(g, 50);
+
+    // The smallest socket buffers, so the blit can't all be written while the
+    // panel isn't reading
+    int size = 1;
+    setsockopt(p[1]->port.handle, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(p[1]->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    set_paused(p[1], 1);
+    CHECK(ulcd_group_blit(g, 0, 0, W, H, image[0]) == N - 1);
+    CHECK(ulcd_group_status(g, 1) == ULCD_GROUP_TIMEOUT);
+
+    // Still hung: skipped
+    CHECK(ulcd_group_clear(g) == N - 1);
+    CHECK(ulcd_group_status(g, 1) == ULCD_GROUP_TIMEOUT);
+
+    set_paused(p[1], 0);
+    CHECK(ulcd_group_blit(g, 0, 0, W, H, image[1]) == N);
+    int i;
+    for(i = 0; i < N; i++) {
+        CHECK(ulcd_group_status(g, i) == ULCD_GROUP_OK);
+        CHECK(shows(p[i], image[1]));
+    }
+    CHECK(fake_panel_count(p[1], 0x49) == 2);
+    CHECK(fake_panel_count(p[1], 0x55) >= 1);
+    CHECK(fake_panel_count(p[1], 0x45) == 0);
+
+    close_group(g, p);
+}
+
+int main() {
+    make_images();
+    test_broadcast();
+    test_hung_member();
+    return test_result("test_group");
+}
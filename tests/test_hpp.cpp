@@ -0,0 +1,82 @@
+#include "test.h"
+#include "ulcd_driver.hpp"
+
+#include <cstring>
+#include <vector>
+
+using namespace ulcd;
+
+// Colours and commands fold to constants
+static_assert(rgb565(255, 0, 0) == 0xF800);
+static_assert(rgb565(0, 255, 0) == 0x07E0);
+static_assert(rgb565(8, 4, 8) == 0x0821);
+static_assert(rgb565f(1.0f, 0.0f, 0.0f) == 0xF800);
+static_assert(rgb565f(2.0f, 1.0f, 1.0f) == 0xFFFF);
+static_assert(rgb565f(0.5f, 0.5f, 0.5f) == ((15 << 11) | (31 << 5) | 15));
+
+constexpr auto red_rect = encode_rect(1, 2, 300, 4, rgb565(255, 0, 0));
+static_assert(red_rect.size() == 11);
+static_assert(red_rect[0] == 0x72 && red_rect[5] == 0x01 && red_rect[6] == 0x2C);
+static_assert(red_rect[9] == (char)0xF8 && red_rect[10] == 0x00);
+static_assert(encode_clear().size() == 1 && encode_clear()[0] == 0x45);
+static_assert(encode_pixel(1, 2, 3).size() == 7);
+static_assert(encode_replace_color(0, 0, 1, 1, 2, 3).size() == 13);
+static_assert(Command<encode_circle(10, 20, 5, 0x001F)>::bytes[6] == 5);
+
+// Views are checked at compile time too
+constexpr uint16_t grid[12] = {};
+static_assert(PixelView(grid, 4, 3).valid());
+static_assert(PixelView(grid, 4, 3).sub(1, 1, 3, 2).valid());
+static_assert(PixelView(grid, 4, 3).sub(1, 1, 3, 2).pixels.size() == 7);
+static_assert(!PixelView(grid, 4, 3).sub(2, 1, 3, 2).valid());
+static_assert(!PixelView(grid, 4, 3).sub(0, 3, 4, 1).valid());
+static_assert(!PixelView(grid, 4, 3).sub(0, 5, 1, 1).valid());
+static_assert(!PixelView(grid, 4, 4).valid());
+
+static void test_colors() {
+    CHECK(rgb565f(0.3f, 0.6f, 0.9f) == alloc_color(0.3f, 0.6f, 0.9f));
+    CHECK(rgb565f(1.0f, 1.0f, 1.0f) == alloc_color(1.0f, 1.0f, 1.0f));
+}
+
+static void test_blit() {
+    fake_panel *p = fake_panel_open(64, 48);
+    Device dev(&p->dev);
+
+    std::vector<uint16_t> px(20 * 10);
+    for(std::size_t i = 0; i < px.size(); i++) {
+        px[i] = (uint16_t)(i + 1);
+    }
+    PixelView all(px, 20, 10);
+
+    // A sub-view is sent from its place in the parent
+    CHECK(dev.blit(5, 6, all.sub(2, 3, 4, 2)));
+    CHECK(fake_panel_pixel(p, 5, 6) == 3 * 20 + 2 + 1);
+    CHECK(fake_panel_pixel(p, 8, 7) == 4 * 20 + 5 + 1);
+
+    // Out of range views and short data fail with an error, sending nothing
+    fake_panel_reset(p);
+    CHECK(!dev.blit(0, 0, all.sub(18, 0, 4, 1)));
+    CHECK(std::strcmp(Device::error(), "Pixel view out of range.") == 0);
+    CHECK(!dev.blit(0, 0, all.sub(0, 60000, 1, 1)));
+    CHECK(!dev.blit(0, 0, PixelView(px, 20, 11)));
+    std::vector<std::byte> data(4 * 4 * 2 - 1);
+    CHECK(!dev.blit(0, 0, 4, 4, data));
+    CHECK(std::strcmp(Device::error(), "Blit data size does not match.") == 0);
+    CHECK(p->count == 0);
+
+    data.resize(4 * 4 * 2);
+    CHECK(dev.blit(0, 0, 4, 4, data));
+    CHECK(fake_panel_count(p, 0x49) == 1);
+
+    CHECK(dev.send<Command<encode_pixel(7, 8, 0x1234)>>());
+    CHECK(fake_panel_pixel(p, 7, 8) == 0x1234);
+
+    dev.release();
+    fake_panel_close(p);
+}
+
+int main() {
+    test_colors();
+    test_blit();
+    return test_result("test_hpp");
+}
@@ -0,0 +1,341 @@
+#include "test.h"
+#include "ulcd_image.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void put_le16(unsigned char *p, int v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_le32(unsigned char *p, int v) {
+    put_le16(p, v & 0xFFFF);
+    put_le16(p + 2, (v >> 16) & 0xFFFF);
+}
+
+// Builds a BMP from top-down RGB pixels. h < 0 stores the rows top-down.
+static unsigned char* make_bmp(int w, int h, int bpp, const unsigned char *rgb, int *len) {
+    int rows = h < 0 ? -h : h;
+    int bytes = bpp / 8;
+    int stride = (w * bytes + 3) & ~3;
+    *len = 54 + stride * rows;
+    unsigned char *b = (unsigned char*)calloc(1, *len);
+    b[0] = 'B';
+    b[1] = 'M';
+    put_le32(b + 2, *len);
+    put_le32(b + 10, 54);
+    put_le32(b + 14, 40);
+    put_le32(b + 18, w);
+    put_le32(b + 22, h);
+    put_le16(b + 26, 1);
+    put_le16(b + 28, bpp);
+    int x, y;
+    for(y = 0; y < rows; y++) {
+        unsigned char *row = b + 54 + (h < 0 ? y : rows - 1 - y) * stride;
+        for(x = 0; x < w; x++) {
+            const unsigned char *p = rgb + (y * w + x) * 3;
+            row[x * bytes + 0] = p[2];
+            row[x * bytes + 1] = p[1];
+            row[x * bytes + 2] = p[0];
+        }
+    }
+    return b;
+}
+
+static int px(const ulcd_image *img, int x, int y) {
+    const unsigned char *d = (const unsigned char*)img->data + (y * img->w + x) * 2;
+    return (d[0] << 8) | d[1];
+}
+
+// Red, green, blue on top, white, black, grey below
+static const unsigned char colors[] = {
+    255, 0, 0,   0, 255, 0,   0, 0, 255,
+    255, 255, 255,   0, 0, 0,   128, 128, 128,
+};
+
+static void check_colors(const ulcd_image *img) {
+    CHECK(img->w == 3 && img->h == 2);
+    CHECK(px(img, 0, 0) == 0xF800);
+    CHECK(px(img, 1, 0) == 0x07E0);
+    CHECK(px(img, 2, 0) == 0x001F);
+    CHECK(px(img, 0, 1) == 0xFFFF);
+    CHECK(px(img, 1, 1) == 0x0000);
+    CHECK(px(img, 2, 1) == ((16 << 11) | (32 << 5) | 16));
+}
+
+static void test_bmp() {
+    int len, bpp;
+    for(bpp = 24; bpp <= 32; bpp += 8) {
+        // Bottom-up, with row padding at 24 bits
+        unsigned char *b = make_bmp(3, 2, bpp, colors, &len);
+        ulcd_image *img = ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE);
+        CHECK(img != 0);
+        if(img) check_colors(img);
+        ulcd_image_free(img);
+
+        // Truncated pixel data
+        CHECK(ulcd_image_convert((char*)b, len - 1, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+        free(b);
+
+        // Top-down
+        b = make_bmp(3, -2, bpp, colors, &len);
+        img = ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE);
+        CHECK(img != 0);
+        if(img) check_colors(img);
+        ulcd_image_free(img);
+        free(b);
+    }
+
+    // Truncated header, unsupported depth
+    unsigned char *b = make_bmp(3, 2, 24, colors, &len);
+    CHECK(ulcd_image_convert((char*)b, 40, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+    put_le16(b + 28, 16);
+    CHECK(ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+    free(b);
+}
+
+// Builds a bottom-up BI_BITFIELDS BMP with the given red, green and blue
+// masks. Each component is stored in its mask's full range.
+static unsigned char* make_bitfields_bmp(int w, int h, int bpp, const unsigned *masks,
+                                         const unsigned char *rgb, int *len) {
+    int bytes = bpp / 8;
+    int stride = (w * bytes + 3) & ~3;
+    *len = 66 + stride * h;
+    unsigned char *b = (unsigned char*)calloc(1, *len);
+    b[0] = 'B';
+    b[1] = 'M';
+    put_le32(b + 2, *len);
+    put_le32(b + 10, 66);
+    put_le32(b + 14, 40);
+    put_le32(b + 18, w);
+    put_le32(b + 22, h);
+    put_le16(b + 26, 1);
+    put_le16(b + 28, bpp);
+    put_le32(b + 30, 3);
+    int x, y, c;
+    for(c = 0; c < 3; c++) {
+        put_le32(b + 54 + c * 4, (int)masks[c]);
+    }
+    for(y = 0; y < h; y++) {
+        unsigned char *row = b + 66 + (h - 1 - y) * stride;
+        for(x = 0; x < w; x++) {
+            unsigned v = 0;
+            for(c = 0; c < 3; c++) {
+                unsigned m = masks[c];
+                int shift = 0;
+                while(!((m >> shift) & 1)) shift++;
+                v |= ((rgb[(y * w + x) * 3 + c] * (m >> shift) + 127) / 255) << shift;
+            }
+            if(bytes == 4) put_le32(row + x * 4, (int)v);
+            else put_le16(row + x * 2, (int)v);
+        }
+    }
+    return b;
+}
+
+// BI_BITFIELDS images are read through their masks, not as BGR.
+static void test_bitfields() {
+    static const unsigned rgba[3] = { 0x000000FF, 0x0000FF00, 0x00FF0000 };
+    static const unsigned rgb565[3] = { 0xF800, 0x07E0, 0x001F };
+    static const unsigned rgb555[3] = { 0x7C00, 0x03E0, 0x001F };
+    int len;
+
+    unsigned char *b = make_bitfields_bmp(3, 2, 32, rgba, colors, &len);
+    ulcd_image *img = ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE);
+    CHECK(img != 0);
+    if(img) check_colors(img);
+    ulcd_image_free(img);
+    CHECK(ulcd_image_convert((char*)b, 60, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+    free(b);
+
+    b = make_bitfields_bmp(3, 2, 16, rgb565, colors, &len);
+    img = ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE);
+    CHECK(img != 0);
+    if(img) check_colors(img);
+    ulcd_image_free(img);
+    free(b);
+
+    b = make_bitfields_bmp(3, 2, 16, rgb555, colors, &len);
+    img = ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE);
+    CHECK(img != 0);
+    if(img) {
+        CHECK(px(img, 0, 0) == 0xF800 && px(img, 1, 0) == 0x07E0 && px(img, 2, 0) == 0x001F);
+    }
+    ulcd_image_free(img);
+
+    // Masks at 24 bits are not allowed
+    put_le16(b + 28, 24);
+    CHECK(ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+    free(b);
+}
+
+static void test_ppm() {
+    char buf[256];
+    int n = sprintf(buf, "P6\n# comment\n3 2\n255\n");
+    memcpy(buf + n, colors, sizeof(colors));
+    ulcd_image *img = ulcd_image_convert(buf, n + sizeof(colors), 0, 0, ULCD_IMAGE_NO_CACHE);
+    CHECK(img != 0);
+    if(img) check_colors(img);
+    ulcd_image_free(img);
+    CHECK(ulcd_image_convert(buf, n + sizeof(colors) - 1, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+
+    // 16 bit samples
+    n = sprintf(buf, "P6 3 2 65535\n");
+    int i;
+    for(i = 0; i < (int)sizeof(colors); i++) {
+        int v = colors[i] * 257;
+        buf[n++] = v >> 8;
+        buf[n++] = v & 0xFF;
+    }
+    img = ulcd_image_convert(buf, n, 0, 0, ULCD_IMAGE_NO_CACHE);
+    CHECK(img != 0);
+    if(img) check_colors(img);
+    ulcd_image_free(img);
+
+    // Bad headers
+    CHECK(ulcd_image_convert("P6 3 2\n", 7, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+    CHECK(ulcd_image_convert("P6 0 2 255\n", 11, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+    CHECK(ulcd_image_convert("P5 1 1 255\nx", 12, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+}
+
+// Sizes whose buffer sizes don't fit in an int must fail cleanly.
+static void test_oversized() {
+    unsigned char hdr[54 + 16];
+    int len = sizeof(hdr);
+    unsigned char *b = make_bmp(1, 1, 24, colors, &len);
+    memcpy(hdr, b, 54);
+    free(b);
+
+    static const int sizes[][2] = {
+        {0x7FFFFFFF, 1}, {0x40000000, 2}, {65536, 65536}, {0x7FFFFFFF, -0x7FFFFFFF},
+        {1, -0x7FFFFFFF - 1},
+    };
+    int i, bpp;
+    for(bpp = 24; bpp <= 32; bpp += 8) {
+        for(i = 0; i < 5; i++) {
+            put_le32(hdr + 18, sizes[i][0]);
+            put_le32(hdr + 22, sizes[i][1]);
+            put_le16(hdr + 28, bpp);
+            CHECK(ulcd_image_convert((char*)hdr, sizeof(hdr), 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+        }
+    }
+
+    char ppm[64];
+    int n = sprintf(ppm, "P6 100000 100000 65535\n");
+    CHECK(ulcd_image_convert(ppm, n, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+    n = sprintf(ppm, "P6 99999999999 1 255\n");
+    CHECK(ulcd_image_convert(ppm, n, 0, 0, ULCD_IMAGE_NO_CACHE) == 0);
+
+    // Target sizes
+    b = make_bmp(3, 2, 24, colors, &len);
+    CHECK(ulcd_image_convert((char*)b, len, 70000, 1, ULCD_IMAGE_NO_CACHE) == 0);
+    CHECK(ulcd_image_convert((char*)b, len, 0, 0x7FFFFFFF, ULCD_IMAGE_NO_CACHE) == 0);
+    CHECK(ulcd_image_convert((char*)b, len, -1, 1, ULCD_IMAGE_NO_CACHE) == 0);
+    free(b);
+}
+
+static void test_scaling() {
+    // Black to white, scaled up: the middle is interpolated
+    static const unsigned char bw[] = { 0, 0, 0,   255, 255, 255 };
+    int len;
+    unsigned char *b = make_bmp(2, 1, 24, bw, &len);
+    ulcd_image *img = ulcd_image_convert((char*)b, len, 3, 1, ULCD_IMAGE_NO_CACHE);
+    CHECK(img != 0);
+    if(img) {
+        CHECK(img->w == 3 && img->h == 1);
+        CHECK(px(img, 0, 0) == 0x0000);
+        CHECK(px(img, 1, 0) == ((16 << 11) | (32 << 5) | 16));
+        CHECK(px(img, 2, 0) == 0xFFFF);
+    }
+    ulcd_image_free(img);
+
+    // One dimension from the aspect ratio
+    img = ulcd_image_convert((char*)b, len, 0, 4, ULCD_IMAGE_NO_CACHE);
+    CHECK(img && img->w == 8 && img->h == 4);
+    ulcd_image_free(img);
+    img = ulcd_image_convert((char*)b, len, 1, 0, ULCD_IMAGE_NO_CACHE);
+    CHECK(img && img->w == 1 && img->h == 1);
+    ulcd_image_free(img);
+    free(b);
+}
+
+// Dithering keeps the average of a colour between two RGB565 levels.
+static void test_dither() {
+    enum { S = 32 };
+    static unsigned char flat[S * S * 3];
+    int i, len;
+    for(i = 0; i < S * S; i++) {
+        flat[i * 3 + 0] = 103;
+        flat[i * 3 + 1] = 103;
+        flat[i * 3 + 2] = 103;
+    }
+    unsigned char *b = make_bmp(S, S, 24, flat, &len);
+    ulcd_image *plain = ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE);
+    ulcd_image *dith = ulcd_image_convert((char*)b, len, 0, 0, ULCD_IMAGE_NO_CACHE | ULCD_IMAGE_DITHER);
+    CHECK(plain && dith);
+    if(plain && dith) {
+        double sum_plain = 0, sum_dith = 0;
+        int levels = 0, first = px(dith, 0, 0);
+        for(i = 0; i < S * S; i++) {
+            sum_plain += ((px(plain, i % S, i / S) >> 11) * 255 + 15) / 31;
+            sum_dith += ((px(dith, i % S, i / S) >> 11) * 255 + 15) / 31;
+            if(px(dith, i % S, i / S) != first) levels = 1;
+        }
+        CHECK(levels);
+        double err_plain = sum_plain / (S * S) - 103, err_dith = sum_dith / (S * S) - 103;
+        if(err_plain < 0) err_plain = -err_plain;
+        if(err_dith < 0) err_dith = -err_dith;
+        CHECK(err_plain > 2.0);
+        CHECK(err_dith < 1.0);
+    }
+    ulcd_image_free(plain);
+    ulcd_image_free(dith);
+    free(b);
+}
+
+static void test_cache() {
+    int len;
+    unsigned char *b = make_bmp(3, 2, 24, colors, &len);
+    ulcd_image *a = ulcd_image_convert((char*)b, len, 0, 0, 0);
+    ulcd_image *c = ulcd_image_convert((char*)b, len, 0, 0, 0);
+    ulcd_image *d = ulcd_image_convert((char*)b, len, 6, 4, 0);
+    CHECK(a != 0 && a == c);
+    CHECK(d != 0 && d != a);
+    ulcd_image_free(a);
+    ulcd_image_free(c);
+    ulcd_image_free(d);
+    ulcd_image_cache_clear();
+    free(b);
+}
+
+static void test_show() {
+    int len;
+    unsigned char *b = make_bmp(3, 2, 24, colors, &len);
+    FILE *f = fopen("test_image.bmp", "wb");
+    CHECK(f != 0);
+    if(!f) return;
+    fwrite(b, 1, len, f);
+    fclose(f);
+    free(b);
+
+    fake_panel *p = fake_panel_open(16, 16);
+    CHECK(ulcd_image_show(&p->dev, "test_image.bmp", 5, 6, 3, 2, ULCD_IMAGE_NO_CACHE));
+    CHECK(fake_panel_count(p, 0x49) == 1);
+    CHECK(fake_panel_pixel(p, 5, 6) == 0xF800);
+    CHECK(fake_panel_pixel(p, 7, 7) == ((16 << 11) | (32 << 5) | 16));
+    fake_panel_close(p);
+    remove("test_image.bmp");
+}
+
+int main() {
+    test_bmp();
+    test_bitfields();
+    test_ppm();
+    test_oversized();
+    test_scaling();
+    test_dither();
+    test_cache();
+    test_show();
+    return test_result("test_image");
+}
@@ -0,0 +1,75 @@
+#include "test.h"
+
+#include <string.h>
+
+#define W 16
+#define H 8
+
+// Columns 0-3 red, 4-7 green, 8-11 blue, 12-15 black
+static void fill(fake_panel *p) {
+    int x, y;
+    static const uint16_t cols[4] = {0xF800, 0x07E0, 0x001F, 0x0000};
+    for(y = 0; y < H; y++) {
+        for(x = 0; x < W; x++) {
+            p->fb[y * W + x] = cols[x / 4];
+        }
+    }
+}
+
+static void test_chain() {
+    fake_panel *p = fake_panel_open(W, H);
+    fill(p);
+
+    // Red->green must not turn the old green pixels red, whatever the order
+    ulcd_color_map rules[] = {
+        {0xF800, 0x07E0},
+        {0x07E0, 0x001F},
+        {0x001F, 0xFFFF},
+    };
+    CHECK(ulcd_replace_colors(&p->dev, 0, 0, W - 1, H - 1, rules, 3, -1));
+    CHECK(fake_panel_count(p, 0x6B) == 3);
+    CHECK(fake_panel_pixel(p, 0, 0) == 0x07E0);
+    CHECK(fake_panel_pixel(p, 4, 0) == 0x001F);
+    CHECK(fake_panel_pixel(p, 8, 0) == 0xFFFF);
+    CHECK(fake_panel_pixel(p, 12, 0) == 0x0000);
+
+    fake_panel_close(p);
+}
+
+static void test_cycle() {
+    fake_panel *p = fake_panel_open(W, H);
+    fill(p);
+
+    // Rotating three colours needs a scratch colour, black is untouched
+    ulcd_color_map rules[] = {
+        {0xF800, 0x07E0},
+        {0x07E0, 0x001F},
+        {0x001F, 0xF800},
+        {0x001F, 0x1234},  // Repeated source, the first rule wins
+        {0x0000, 0x0000},  // Identity, not sent
+    };
+
+    // Without one, or with one a rule uses, nothing is sent
+    CHECK(!ulcd_replace_colors(&p->dev, 0, 0, W - 1, H / 2 - 1, rules, 5, -1));
+    CHECK(!ulcd_replace_colors(&p->dev, 0, 0, W - 1, H / 2 - 1, rules, 5, 0x07E0));
+    CHECK(fake_panel_count(p, 0x6B) == 0);
+
+    CHECK(ulcd_replace_colors(&p->dev, 0, 0, W - 1, H / 2 - 1, rules, 5, 0x0821));
+    CHECK(fake_panel_count(p, 0x6B) == 4);
+    CHECK(fake_panel_pixel(p, 0, 0) == 0x07E0);
+    CHECK(fake_panel_pixel(p, 4, 0) == 0x001F);
+    CHECK(fake_panel_pixel(p, 8, 0) == 0xF800);
+    CHECK(fake_panel_pixel(p, 12, 0) == 0x0000);
+
+    // Outside the region nothing changes
+    CHECK(fake_panel_pixel(p, 0, H - 1) == 0xF800);
+    CHECK(fake_panel_pixel(p, 8, H - 1) == 0x001F);
+
+    fake_panel_close(p);
+}
+
+int main() {
+    test_chain();
+    test_cycle();
+    return test_result("test_replace");
+}
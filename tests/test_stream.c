@@ -0,0 +1,174 @@
+#include "test.h"
+#include "ulcd_stream.h"
+
+#include <string.h>
+
+#define SX 8
+#define SY 4
+#define SW 32
+#define SH 40
+
+// Frame script: the source returns frames until count is reached.
+typedef struct {
+    int frame, count;
+    uint16_t last[SW * SH];
+} script;
+
+static void draw_frame(int n, uint16_t *px) {
+    int x, y;
+    for(y = 0; y < SH; y++) {
+        for(x = 0; x < SW; x++) {
+            px[y * SW + x] = x + y * SW + 1;
+        }
+    }
+    if(n >= 1) {
+        px[5 * SW + 3] = 0xAAAA;
+        px[6 * SW + 10] = 0xBBBB;
+    }
+    if(n >= 2) {
+        for(x = 0; x < SW; x++) {
+            px[x] = 0x1111;
+            px[20 * SW + x] = 0x2222;
+        }
+    }
+}
+
+static int script_source(void *userdata, uint16_t *pixels, int w, int h) {
+    script *s = (script*)userdata;
+    CHECK(w == SW && h == SH);
+    if(s->frame == s->count) {
+        return 0;
+    }
+    draw_frame(s->frame < 3 ? s->frame : 2, pixels);
+    memcpy(s->last, pixels, sizeof(s->last));
+    s->frame++;
+    return 1;
+}
+
+// A bar moving down one row per frame
+static int bar_source(void *userdata, uint16_t *pixels, int w, int h) {
+    script *s = (script*)userdata;
+    if(s->frame == s->count) {
+        return 0;
+    }
+    int x, y;
+    for(y = 0; y < h; y++) {
+        for(x = 0; x < w; x++) {
+            pixels[y * w + x] = (y == s->frame % h) ? 0xFFFF : (uint16_t)(s->frame / h + 1);
+        }
+    }
+    memcpy(s->last, pixels, sizeof(s->last));
+    s->frame++;
+    return 1;
+}
+
+static int shows(fake_panel *p, const uint16_t *frame) {
+    int x, y;
+    for(y = 0; y < SH; y++) {
+        for(x = 0; x < SW; x++) {
+            if(fake_panel_pixel(p, SX + x, SY + y) != frame[y * SW + x]) return 0;
+        }
+    }
+    return 1;
+}
+
+static int blit_is(const fake_cmd *c, int x, int y, int w, int h) {
+    return c && fake_word(c, 1) == x && fake_word(c, 3) == y
+             && fake_word(c, 5) == w && fake_word(c, 7) == h;
+}
+
+// Only changed rows are sent, close ones as one rectangle.
+static void test_delta() {
+    fake_panel *p = fake_panel_open(64, 48);
+    script s;
+    memset(&s, 0, sizeof(s));
+    s.count = 4;
+
+    ulcd_stream *st = ulcd_stream_start(&p->dev, SX, SY, SW, SH, script_source, &s, ULCD_STREAM_BLOCK);
+    CHECK(st != 0);
+    if(!st) return;
+    CHECK(ulcd_stream_wait(st));
+
+    ulcd_stream_stats stats;
+    ulcd_stream_get_stats(st, &stats);
+    CHECK(stats.frames_produced == 4);
+    CHECK(stats.frames_sent == 4);
+    CHECK(stats.frames_dropped == 0);
+    CHECK(stats.blits == 4);
+
+    // Full frame, both pixels, then the two far apart rows. The last frame
+    // is unchanged and sends nothing.
+    CHECK(fake_panel_count(p, 0x49) == 4);
+    CHECK(blit_is(fake_panel_find(p, 0x49, 0), SX, SY, SW, SH));
+    CHECK(blit_is(fake_panel_find(p, 0x49, 1), SX + 3, SY + 5, 8, 2));
+    CHECK(blit_is(fake_panel_find(p, 0x49, 2), SX, SY, SW, 1));
+    CHECK(blit_is(fake_panel_find(p, 0x49, 3), SX, SY + 20, SW, 1));
+    CHECK(stats.bytes_sent == p->bytes);
+    CHECK(shows(p, s.last));
+
+    ulcd_stream_stop(st);
+    fake_panel_close(p);
+}
+
+// Dropped frames must not break the deltas of the ones that are sent.
+static void test_drop() {
+    int policy;
+    for(policy = ULCD_STREAM_DROP_OLDEST; policy <= ULCD_STREAM_DROP_NEWEST; policy++) {
+        fake_panel *p = fake_panel_open(64, 48);
+        p->delay_us = 2000;
+        script s;
+        memset(&s, 0, sizeof(s));
+        s.count = 100;
+
+        ulcd_stream *st = ulcd_stream_start(&p->dev, SX, SY, SW, SH, bar_source, &s, policy);
+        CHECK(st != 0);
+        if(!st) return;
+        CHECK(ulcd_stream_wait(st));
+
+        ulcd_stream_stats stats;
+        ulcd_stream_get_stats(st, &stats);
+        CHECK(stats.frames_produced == 100);
+        CHECK(stats.frames_dropped > 0);
+        CHECK(stats.frames_sent + stats.frames_dropped == 100);
+        if(policy == ULCD_STREAM_DROP_OLDEST) {
+            // The newest frame is always sent
+            CHECK(shows(p, s.last));
+        }
+
+        ulcd_stream_stop(st);
+        fake_panel_close(p);
+    }
+}
+
+// After a failed blit the next frame encoded is sent in full, so the panel
+// ends up right.
+static void test_error_recovery() {
+    fake_panel *p = fake_panel_open(64, 48);
+    p->nak = 1;
+    script s;
+    memset(&s, 0, sizeof(s));
+    s.count = 3;
+
+    ulcd_stream *st = ulcd_stream_start(&p->dev, SX, SY, SW, SH, script_source, &s, ULCD_STREAM_BLOCK);
+    CHECK(st != 0);
+    if(!st) return;
+    CHECK(!ulcd_stream_wait(st));
+
+    ulcd_stream_stats stats;
+    ulcd_stream_get_stats(st, &stats);
+    CHECK(stats.errors == 1);
+    // Frame 1 may already have been encoded as a delta when the error came
+    CHECK(blit_is(fake_panel_find(p, 0x49, 1), SX, SY, SW, SH)
+          || blit_is(fake_panel_find(p, 0x49, 2), SX, SY, SW, SH));
+    CHECK(shows(p, s.last));
+
+    ulcd_stream_stop(st);
+    fake_panel_close(p);
+}
+
+int main() {
+    test_delta();
+    test_drop();
+    test_error_recovery();
+    return test_result("test_stream");
+}
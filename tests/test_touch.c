@@ -0,0 +1,109 @@
+#include "test.h"
+#include "ulcd_touch.h"
+
+// Touch queries sent to the panel with the given sub command
+static int queries(fake_panel *p, int sub) {
+    int i, n = 0;
+    for(i = 0; i < p->count; i++) {
+        if(p->cmds[i].op == 0x6F && p->cmds[i].head[1] == sub) n++;
+    }
+    return n;
+}
+
+// Polls now, whatever the interval says.
+static int poll_now(ulcd_touch_poller *t) {
+    t->next_poll = 0;
+    return ulcd_touch_poll(t);
+}
+
+static void test_backoff() {
+    fake_panel *p = fake_panel_open(64, 48);
+    ulcd_touch_poller t;
+    ulcd_touch_init(&t, &p->dev, 2, 50);
+    CHECK(t.interval == 2);
+
+    // Idle: the interval doubles up to the maximum, and only the status is
+    // queried.
+    static const int expect[] = {4, 8, 16, 32, 50, 50};
+    int i;
+    for(i = 0; i < 6; i++) {
+        CHECK(poll_now(&t) == 0);
+        CHECK(t.interval == expect[i]);
+    }
+    CHECK(queries(p, 0x04) == 6);
+    CHECK(queries(p, 0x05) == 0);
+    CHECK(ulcd_touch_next_poll_ms(&t) > 0);
+
+    // Not due yet: the link is left alone
+    CHECK(ulcd_touch_poll(&t) == 0);
+    CHECK(queries(p, 0x04) == 6);
+
+    // A touch drops to the minimum and stays there while touching
+    fake_panel_touch(p, ULCD_TOUCH_PRESS, 10, 20);
+    CHECK(poll_now(&t) == 1);
+    CHECK(t.interval == 2);
+    CHECK(queries(p, 0x05) == 1);
+    fake_panel_touch(p, ULCD_NO_ACTIVITY, 0, 0);
+    poll_now(&t);
+    poll_now(&t);
+    CHECK(t.interval == 2);
+
+    // Released: backing off again
+    fake_panel_touch(p, ULCD_TOUCH_RELEASE, 10, 20);
+    CHECK(poll_now(&t) == 2);
+    fake_panel_touch(p, ULCD_NO_ACTIVITY, 0, 0);
+    poll_now(&t);
+    CHECK(t.interval == 4);
+
+    ulcd_event ev;
+    CHECK(ulcd_touch_get(&t, &ev));
+    CHECK(ev.type == ULCD_TOUCH_PRESS && ev.x == 10 && ev.y == 20);
+    CHECK(ulcd_touch_get(&t, &ev));
+    CHECK(ev.type == ULCD_TOUCH_RELEASE);
+    CHECK(!ulcd_touch_get(&t, &ev));
+
+    fake_panel_close(p);
+}
+
+static void test_queue() {
+    fake_panel *p = fake_panel_open(64, 48);
+    ulcd_touch_poller t;
+    ulcd_touch_init(&t, &p->dev, 0, 100);
+    ulcd_event ev;
+
+    // Unread moves are merged into the last one
+    fake_panel_touch(p, ULCD_TOUCH_PRESS, 1, 1);
+    poll_now(&t);
+    fake_panel_touch(p, ULCD_TOUCH_MOVING, 2, 2);
+    poll_now(&t);
+    fake_panel_touch(p, ULCD_TOUCH_MOVING, 3, 4);
+    CHECK(poll_now(&t) == 2);
+    fake_panel_touch(p, ULCD_TOUCH_RELEASE, 3, 4);
+    CHECK(poll_now(&t) == 3);
+    CHECK(ulcd_touch_get(&t, &ev) && ev.type == ULCD_TOUCH_PRESS);
+    CHECK(ulcd_touch_get(&t, &ev) && ev.type == ULCD_TOUCH_MOVING && ev.x == 3 && ev.y == 4);
+    CHECK(ulcd_touch_get(&t, &ev) && ev.type == ULCD_TOUCH_RELEASE);
+
+    // A full queue drops the oldest events
+    int i;
+    for(i = 0; i < ULCD_TOUCH_QUEUE + 4; i++) {
+        fake_panel_touch(p, (i & 1) ? ULCD_TOUCH_RELEASE : ULCD_TOUCH_PRESS, i, 0);
+        poll_now(&t);
+    }
+    CHECK(t.count == ULCD_TOUCH_QUEUE);
+    CHECK(ulcd_touch_get(&t, &ev) && ev.x == 4);
+
+    // Waiting returns what is queued, then polls for more
+    while(ulcd_touch_get(&t, &ev));
+    fake_panel_touch(p, ULCD_TOUCH_PRESS, 7, 8);
+    ulcd_touch_wait(&t, &ev);
+    CHECK(ev.type == ULCD_TOUCH_PRESS && ev.x == 7 && ev.y == 8);
+
+    fake_panel_close(p);
+}
+
+int main() {
+    test_backoff();
+    test_queue();
+    return test_result("test_touch");
+}
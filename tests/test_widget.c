@@ -0,0 +1,160 @@
+#include "test.h"
+#include "ulcd_widget.h"
+
+#define W 128
+#define H 96
+
+#define RED 0xF800
+#define GREEN 0x07E0
+#define BLUE 0x001F
+
+static void test_pen_changes() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_ui *ui = ulcd_ui_create(&p->dev, 0);
+    ulcd_widget *gauge = ulcd_ui_add(ui, ULCD_WIDGET_GAUGE, 10, 10, 52, 10, 0);
+    ulcd_widget_set_colors(gauge, RED, BLUE);
+
+    // A full paint outlines the gauge, then puts the pen back
+    CHECK(ulcd_ui_paint(ui));
+    CHECK(fake_panel_pixel(p, 10, 10) == RED);
+    CHECK(fake_panel_pixel(p, 30, 15) == BLUE);
+    CHECK(p->pen == ULCD_PEN_SOLID && p->dev.pen == ULCD_PEN_SOLID);
+
+    // A new value is one rectangle and nothing else
+    fake_panel_reset(p);
+    ulcd_widget_set_value(gauge, 50);
+    CHECK(ulcd_ui_paint(ui));
+    CHECK(p->count == 1 && p->cmds[0].op == 0x72);
+    CHECK(fake_panel_pixel(p, 30, 15) == RED);
+    CHECK(fake_panel_pixel(p, 40, 15) == BLUE);
+
+    // Nothing dirty, nothing sent
+    fake_panel_reset(p);
+    CHECK(ulcd_ui_paint(ui));
+    CHECK(p->count == 0);
+
+    // A caller's wireframe pen is kept
+    CHECK(ulcd_pen_style(&p->dev, ULCD_PEN_WIREFRAME));
+    ulcd_widget_set_value(gauge, 20);
+    CHECK(ulcd_ui_paint(ui));
+    CHECK(p->pen == ULCD_PEN_WIREFRAME);
+
+    ulcd_ui_free(ui);
+    fake_panel_close(p);
+}
+
+// Widgets added later stay on top whatever is repainted.
+static void test_stacking() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_ui *ui = ulcd_ui_create(&p->dev, 0);
+    ulcd_widget *under = ulcd_ui_add(ui, ULCD_WIDGET_LABEL, 0, 0, 60, 40, 0);
+    ulcd_widget *over = ulcd_ui_add(ui, ULCD_WIDGET_LABEL, 20, 10, 20, 20, 0);
+    ulcd_widget *apart = ulcd_ui_add(ui, ULCD_WIDGET_LABEL, 80, 0, 20, 20, 0);
+    ulcd_widget_set_colors(under, 0xFFFF, RED);
+    ulcd_widget_set_colors(over, 0xFFFF, GREEN);
+    ulcd_widget_set_colors(apart, 0xFFFF, BLUE);
+    CHECK(ulcd_ui_paint(ui));
+    CHECK(fake_panel_pixel(p, 5, 5) == RED);
+    CHECK(fake_panel_pixel(p, 30, 20) == GREEN);
+    CHECK(fake_panel_pixel(p, 90, 10) == BLUE);
+
+    // Repainting the lower one repaints the one on top, not the one apart
+    fake_panel_reset(p);
+    ulcd_widget_set_colors(under, 0xFFFF, BLUE);
+    CHECK(ulcd_ui_paint(ui));
+    CHECK(fake_panel_pixel(p, 5, 5) == BLUE);
+    CHECK(fake_panel_pixel(p, 30, 20) == GREEN);
+    CHECK(fake_panel_count(p, 0x72) == 2);
+
+    // Hiding the top one shows what is under it
+    ulcd_widget_set_visible(over, 0);
+    CHECK(ulcd_ui_paint(ui));
+    CHECK(fake_panel_pixel(p, 30, 20) == BLUE);
+    CHECK(fake_panel_pixel(p, 5, 5) == BLUE);
+
+    // Hiding the bottom one erases it, and the top one is drawn again
+    ulcd_widget_set_visible(over, 1);
+    ulcd_widget_set_visible(under, 0);
+    CHECK(ulcd_ui_paint(ui));
+    CHECK(fake_panel_pixel(p, 5, 5) == 0);
+    CHECK(fake_panel_pixel(p, 30, 20) == GREEN);
+
+    ulcd_ui_free(ui);
+    fake_panel_close(p);
+}
+
+static int clicks[3];
+
+static void on_click(ulcd_widget *widget, void *userdata) {
+    (void)widget;
+    clicks[*(int*)userdata]++;
+}
+
+static int tap(ulcd_ui *ui, int x, int y) {
+    ulcd_event ev;
+    ev.x = x;
+    ev.y = y;
+    ev.type = ULCD_TOUCH_PRESS;
+    int used = ulcd_ui_dispatch(ui, &ev);
+    ev.type = ULCD_TOUCH_RELEASE;
+    ulcd_ui_dispatch(ui, &ev);
+    return used;
+}
+
+static void test_hits() {
+    fake_panel *p = fake_panel_open(W, H);
+    ulcd_ui *ui = ulcd_ui_create(&p->dev, 0);
+    static int ids[3] = {0, 1, 2};
+
+    // A button across several grid cells, a smaller one on top of it and a
+    // checkbox at the bottom right edge
+    ulcd_widget *big = ulcd_ui_add(ui, ULCD_WIDGET_BUTTON, 20, 20, 60, 50, "big");
+    ulcd_widget *small = ulcd_ui_add(ui, ULCD_WIDGET_BUTTON, 30, 30, 10, 10, "s");
+    ulcd_widget *check = ulcd_ui_add(ui, ULCD_WIDGET_CHECKBOX, W - 16, H - 16, 16, 16, 0);
+    ulcd_ui_add(ui, ULCD_WIDGET_LABEL, 0, 0, 10, 10, "label");
+    ulcd_widget_set_callback(big, on_click, &ids[0]);
+    ulcd_widget_set_callback(small, on_click, &ids[1]);
+    ulcd_widget_set_callback(check, on_click, &ids[2]);
+
+    CHECK(tap(ui, 35, 35));
+    CHECK(clicks[0] == 0 && clicks[1] == 1);
+    CHECK(tap(ui, 79, 69));
+    CHECK(tap(ui, 20, 20));
+    CHECK(clicks[0] == 2);
+    CHECK(!tap(ui, 80, 35));
+    CHECK(!tap(ui, 5, 5));
+    CHECK(!tap(ui, -1, 5));
+    CHECK(!tap(ui, W + 10, H + 10));
+    CHECK(tap(ui, W - 1, H - 1));
+    CHECK(clicks[2] == 1 && check->value == 1);
+
+    // Hidden widgets let touches through to the one under them
+    ulcd_widget_set_visible(small, 0);
+    CHECK(tap(ui, 35, 35));
+    CHECK(clicks[0] == 3 && clicks[1] == 1);
+
+    // Released outside: no click
+    ulcd_event ev;
+    ev.type = ULCD_TOUCH_PRESS;
+    ev.x = 50;
+    ev.y = 50;
+    CHECK(ulcd_ui_dispatch(ui, &ev));
+    CHECK(big->pressed);
+    ev.type = ULCD_TOUCH_MOVING;
+    ev.x = 100;
+    CHECK(ulcd_ui_dispatch(ui, &ev));
+    CHECK(!big->pressed);
+    ev.type = ULCD_TOUCH_RELEASE;
+    CHECK(ulcd_ui_dispatch(ui, &ev));
+    CHECK(clicks[0] == 3);
+
+    ulcd_ui_free(ui);
+    fake_panel_close(p);
+}
+
+int main() {
+    test_pen_changes();
+    test_stacking();
+    test_hits();
+    return test_result("test_widget");
+}